@@ -0,0 +1,242 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#include <eva/FlowTracker.h>
+#include <eva/ResultSink.h>
+#include <eva/hash.h>
+
+using namespace eva;
+
+namespace
+{
+
+const uint32_t kSenderIP = 0x0100000a; // 10.0.0.1 in network order
+const uint32_t kMss = 1460;
+
+// a hardware counter of this process in user space, or none if the
+// kernel or the machine does not offer it
+class PerfCounter: noncopyable
+{
+public:
+    PerfCounter(uint32_t type, uint64_t config)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(__NR_perf_event_open, &attr,
+                                       0, -1, -1, 0));
+    }
+
+    ~PerfCounter()
+    {
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    bool valid() const { return fd_ >= 0; }
+
+    void start()
+    {
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    void stop()
+    {
+        if (fd_ >= 0)
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    uint64_t read() const
+    {
+        uint64_t count = 0;
+        if (fd_ < 0 || ::read(fd_, &count, sizeof(count)) != sizeof(count))
+            return 0;
+        return count;
+    }
+
+private:
+    int fd_;
+};
+
+Unit makeUnit(int64_t when, uint32_t srcIP, uint32_t dstIP,
+              uint16_t srcPort, uint16_t dstPort, uint8_t flag)
+{
+    Unit u = Unit();
+    u.when = Timestamp(when);
+    u.srcIP = srcIP;
+    u.dstIP = dstIP;
+    u.srcPort = srcPort;
+    u.dstPort = dstPort;
+    u.flag = flag;
+    u.recvWindow = 65535;
+    u.hashCode = generateHashCode(srcIP, dstIP, srcPort, dstPort);
+    return u;
+}
+
+uint32_t receiverIP(uint32_t flow) { return htobe32(0x0b000000 + flow); }
+uint16_t receiverPort(uint32_t flow)
+{
+    return htobe16(static_cast<uint16_t>(10000 + flow % 50000));
+}
+
+// |nFlows| flows open at once. every round trip each flow sends a
+// window of |window| segments, then gets them acked one by one. units go
+// round robin over the flows, so consecutive units always belong to
+// different flows and a table much larger than the cache misses on
+// every unit
+class Workload
+{
+public:
+    Workload(uint32_t nFlows, uint32_t window, int64_t start)
+            : nFlows_(nFlows),
+              window_(window),
+              now_(start),
+              seqs_(nFlows)
+    {
+        for (uint32_t i = 0; i < nFlows; i++)
+            seqs_[i] = i * 7919;
+    }
+
+    void handshake(std::vector<Unit>* units)
+    {
+        units->clear();
+        for (uint32_t i = 0; i < nFlows_; i++) {
+            auto syn = makeUnit(now_ + i, kSenderIP, receiverIP(i),
+                                htobe16(80), receiverPort(i), TH_SYN);
+            syn.dataSequence = seqs_[i]++;
+            units->push_back(syn);
+        }
+        now_ += nFlows_;
+        for (uint32_t i = 0; i < nFlows_; i++) {
+            auto synAck = makeUnit(now_ + i, receiverIP(i), kSenderIP,
+                                   receiverPort(i), htobe16(80),
+                                   TH_SYN | TH_ACK);
+            synAck.ackSequence = seqs_[i];
+            synAck.seeMss = true;
+            synAck.mss = kMss;
+            synAck.seeWsc = true;
+            synAck.wsc = 7;
+            units->push_back(synAck);
+        }
+        now_ += nFlows_;
+    }
+
+    // the |segment|th data units of a round trip, or with |ack| their acks
+    void wave(uint32_t segment, bool ack, std::vector<Unit>* units)
+    {
+        units->clear();
+        for (uint32_t i = 0; i < nFlows_; i++) {
+            Unit u;
+            if (!ack) {
+                u = makeUnit(now_ + i, kSenderIP, receiverIP(i),
+                             htobe16(80), receiverPort(i), TH_ACK);
+                u.dataSequence = seqs_[i] + segment * kMss;
+                u.dataLength = kMss;
+            }
+            else {
+                u = makeUnit(now_ + i, receiverIP(i), kSenderIP,
+                             receiverPort(i), htobe16(80), TH_ACK);
+                u.ackSequence = seqs_[i] + (segment + 1) * kMss;
+            }
+            units->push_back(u);
+        }
+        now_ += nFlows_;
+        if (ack && segment + 1 == window_) {
+            for (auto& seq: seqs_)
+                seq += window_ * kMss;
+        }
+    }
+
+private:
+    const uint32_t nFlows_;
+    const uint32_t window_;
+    int64_t now_;
+    std::vector<uint32_t> seqs_;
+};
+
+void bench(uint32_t nFlows, uint32_t window, int rounds)
+{
+    PerfCounter l1dMisses(PERF_TYPE_HW_CACHE,
+                          PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    PerfCounter llcMisses(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+    FlowTracker tracker(kSenderIP, 0);
+    Workload workload(nFlows, window,
+                      1500000000LL * Timestamp::kMicroSecondsPerSecond);
+    std::vector<Unit> units;
+    workload.handshake(&units);
+    for (auto& unit: units)
+        tracker.onUnit(&unit);
+
+    double seconds = 0;
+    uint64_t l1d = 0, llc = 0;
+    size_t count = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (int ack = 0; ack < 2; ack++) {
+            for (uint32_t segment = 0; segment < window; segment++) {
+                workload.wave(segment, ack != 0, &units);
+                l1dMisses.start();
+                llcMisses.start();
+                auto start = Timestamp::now();
+                for (auto& unit: units)
+                    tracker.onUnit(&unit);
+                seconds += timeDifference(Timestamp::now(), start);
+                l1dMisses.stop();
+                llcMisses.stop();
+                l1d += l1dMisses.read();
+                llc += llcMisses.read();
+                count += units.size();
+            }
+        }
+    }
+
+    auto perUnit = [count](uint64_t n) {
+        return static_cast<double>(n) / static_cast<double>(count);
+    };
+    printf("%8u flows %7.1f ns/unit", nFlows,
+           seconds * 1e9 / static_cast<double>(count));
+    if (l1dMisses.valid())
+        printf("  L1D misses %5.2f/unit", perUnit(l1d));
+    if (llcMisses.valid())
+        printf("  LLC misses %5.2f/unit", perUnit(llc));
+    if (!l1dMisses.valid() && !llcMisses.valid())
+        printf("  (no hardware cache counters)");
+    printf("\n");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t maxFlows = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 500000;
+    uint32_t window = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 10;
+    int rounds = argc > 3 ? atoi(argv[3]) : 5;
+
+    Logger::setLogLevel(Logger::FATAL);
+    Logger::setOutput([](const char*, int) {});
+    NullResultSink nullSink;
+    setResultSink(&nullSink);
+
+    printf("%lu bytes per analyzer, %u segments per round trip\n",
+           sizeof(Analyzer), window);
+    for (uint32_t n = 1000; n < maxFlows; n *= 10)
+        bench(n, window, rounds);
+    bench(maxFlows, window, rounds);
+}
@@ -0,0 +1,130 @@
+//
+// Created by frank on 18-2-1.
+//
+
+#include <random>
+#include <unordered_map>
+
+#include <eva/FlowTable.h>
+#include <eva/hash.h>
+
+using namespace eva;
+
+namespace
+{
+
+// stand-in for per flow analyzer state
+struct Flow
+{
+    uint64_t packets = 0;
+    char     state[120];
+};
+
+std::vector<Unit> makeUnits(size_t n)
+{
+    std::mt19937 gen(0);
+    std::vector<Unit> units(n);
+    for (auto& u: units) {
+        u.srcIP = static_cast<uint32_t>(gen());
+        u.dstIP = static_cast<uint32_t>(gen());
+        u.srcPort = static_cast<uint16_t>(gen());
+        u.dstPort = static_cast<uint16_t>(gen());
+        u.hashCode = generateHashCode(u.srcIP, u.dstIP, u.srcPort, u.dstPort);
+    }
+    return units;
+}
+
+double nsPerOp(Timestamp start, size_t n)
+{
+    return timeDifference(Timestamp::now(), start) * 1e9 / static_cast<double>(n);
+}
+
+void benchUnorderedMap(const std::vector<Unit>& units,
+                       const std::vector<size_t>& order)
+{
+    std::unordered_map<Unit, Flow*> map;
+
+    auto start = Timestamp::now();
+    for (auto& u: units)
+        map.emplace(u, new Flow);
+    double insert = nsPerOp(start, units.size());
+
+    start = Timestamp::now();
+    uint64_t sum = 0;
+    for (auto i: order) {
+        auto it = map.find(units[i]);
+        sum += ++it->second->packets;
+    }
+    double find = nsPerOp(start, order.size());
+
+    // churn: every flow ends and a new one with the same tuple begins
+    start = Timestamp::now();
+    for (auto i: order) {
+        auto it = map.find(units[i]);
+        delete it->second;
+        map.erase(it);
+        map.emplace(units[i], new Flow);
+    }
+    double churn = nsPerOp(start, order.size());
+
+    printf("unordered_map<Unit, Flow*>  insert %6.1f ns  find %6.1f ns  "
+           "churn %6.1f ns  (%lu)\n", insert, find, churn, sum);
+
+    for (auto& p: map)
+        delete p.second;
+}
+
+void benchFlowTable(const std::vector<Unit>& units,
+                    const std::vector<size_t>& order)
+{
+    FlowTable<Flow> table;
+
+    auto start = Timestamp::now();
+    for (auto& u: units) {
+        auto key = makeFlowKey(u);
+        table.emplace(table.lookup(key), key);
+    }
+    double insert = nsPerOp(start, units.size());
+
+    start = Timestamp::now();
+    uint64_t sum = 0;
+    for (auto i: order) {
+        auto slot = table.lookup(makeFlowKey(units[i]));
+        sum += ++slot->value->packets;
+    }
+    double find = nsPerOp(start, order.size());
+
+    start = Timestamp::now();
+    for (auto i: order) {
+        auto key = makeFlowKey(units[i]);
+        table.erase(table.lookup(key));
+        table.emplace(table.lookup(key), key);
+    }
+    double churn = nsPerOp(start, order.size());
+
+    printf("FlowTable<Flow>             insert %6.1f ns  find %6.1f ns  "
+           "churn %6.1f ns  (%lu)\n", insert, find, churn, sum);
+    printf("FlowTable memory: %lu bytes, %lu buckets, %.1f bytes/flow\n",
+           table.memoryBytes(), table.bucketCount(),
+           static_cast<double>(table.memoryBytes()) /
+           static_cast<double>(table.size()));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t nFlows = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+
+    auto units = makeUnits(nFlows);
+    std::vector<size_t> order(nFlows);
+    for (size_t i = 0; i < nFlows; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    printf("%lu concurrent flows, sizeof(Unit) = %lu, sizeof(FlowKey) = %lu\n",
+           nFlows, sizeof(Unit), sizeof(FlowKey));
+
+    benchUnorderedMap(units, order);
+    benchFlowTable(units, order);
+}
@@ -0,0 +1,94 @@
+//
+// Created by frank on 18-2-7.
+//
+
+#include <eva/PacketRing.h>
+#include <eva/Capture.h>
+
+using namespace eva;
+
+namespace
+{
+
+const size_t kBatchSize = 64;
+
+// capture for |seconds| and parse every frame, like run does
+void bench(const char* name, PacketSource& source, double seconds)
+{
+    PacketRecord records[kBatchSize];
+    Unit units[kBatchSize];
+    UnpackStats stats;
+    uint64_t bytes = 0;
+
+    auto start = Timestamp::now();
+    double elapsed = 0;
+    while (elapsed < seconds) {
+        size_t n = source.read(records, kBatchSize);
+        for (size_t i = 0; i < n; i++)
+            bytes += records[i].caplen;
+        unpackBatch(records, n, source.linkType(), units,
+                    kTrustChecksum, &stats);
+        elapsed = timeDifference(Timestamp::now(), start);
+    }
+
+    printf("%-8s %6.2f Mpps  %8.1f MB/s  ", name,
+           static_cast<double>(stats.packets) / elapsed / 1e6,
+           static_cast<double>(bytes) / elapsed / 1e6);
+    stats.print(stdout);
+
+    CaptureStats captureStats;
+    if (source.captureStats(&captureStats)) {
+        printf("%-8s ", name);
+        captureStats.print(stdout);
+    }
+}
+
+}
+
+// e.g. on a veth pair or lo while iperf3 is running:
+//   ./packet_ring_bench lo 10 ring 4194304 64 2048 10
+//   ./packet_ring_bench lo 10 ring 4194304 64 2048 10 128
+//   ./packet_ring_bench lo 10 pcap
+int main(int argc, char** argv)
+{
+    if (argc < 4) {
+        printf("./packet_ring_bench interface seconds ring|pcap "
+               "[blockSize blockCount frameSize retireTimeoutMs snaplen]\n");
+        exit(1);
+    }
+
+    const char* interface = argv[1];
+    double seconds = atof(argv[2]);
+    const char* backend = argv[3];
+
+    if (strcmp(backend, "ring") == 0) {
+        PacketRingOptions options;
+        if (argc > 4) options.blockSize = static_cast<uint32_t>(atoi(argv[4]));
+        if (argc > 5) options.blockCount = static_cast<uint32_t>(atoi(argv[5]));
+        if (argc > 6) options.frameSize = static_cast<uint32_t>(atoi(argv[6]));
+        if (argc > 7) options.retireTimeoutMs = static_cast<uint32_t>(atoi(argv[7]));
+        if (argc > 8) options.snaplen = static_cast<uint32_t>(atoi(argv[8]));
+        // wake up now and then to check the clock on an idle interface
+        options.readTimeoutMs = 100;
+
+        PacketRing ring(interface, options);
+        if (!ring.valid()) {
+            printf("%s\n", ring.error().c_str());
+            exit(1);
+        }
+        bench("ring", ring, seconds);
+        printf("ring     %lu queue freezes\n", ring.freezes());
+    }
+    else {
+        char errbuf[PCAP_ERRBUF_SIZE];
+        // the settings run and run2 used to have, libpcap blocks on an
+        // idle interface, so keep traffic running until the end
+        pcap_t* cap = pcap_open_live(interface, 65560, 1, 0, errbuf);
+        if (cap == nullptr) {
+            printf("%s\n", errbuf);
+            exit(1);
+        }
+        PcapSource source(cap, true);
+        bench("pcap", source, seconds);
+    }
+}
@@ -0,0 +1,101 @@
+//
+// Created by frank on 18-2-6.
+//
+
+#include <eva/PcapFile.h>
+#include <eva/Capture.h>
+
+using namespace eva;
+
+namespace
+{
+
+const size_t kBatchSize = 64;
+
+void report(const char* name, double seconds, uint64_t packets, uint64_t bytes,
+            const UnpackStats& stats)
+{
+    printf("%-16s %7.1f ns/packet  %6.2f Mpps  %7.1f MB/s  ", name,
+           seconds * 1e9 / static_cast<double>(packets),
+           static_cast<double>(packets) / seconds / 1e6,
+           static_cast<double>(bytes) / seconds / 1e6);
+    stats.print(stdout);
+}
+
+// the old driver loop: pcap_next() copies every record
+// into the libpcap buffer, then unpack one at a time
+void benchLibpcap(const char* path, bool parse)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t* cap = pcap_open_offline(path, errbuf);
+    if (cap == nullptr) {
+        printf("%s\n", errbuf);
+        exit(1);
+    }
+    int linkType = pcap_datalink(cap);
+
+    struct pcap_pkthdr hdr;
+    const unsigned char* data;
+    UnpackStats stats;
+    uint64_t packets = 0, bytes = 0;
+    Unit unit;
+
+    auto start = Timestamp::now();
+    while ((data = pcap_next(cap, &hdr)) != nullptr) {
+        packets++;
+        bytes += hdr.caplen;
+        if (parse)
+            stats.add(unpackUnit(&hdr, data, linkType, &unit));
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    pcap_close(cap);
+
+    report(parse ? "libpcap+unpack" : "libpcap", seconds, packets, bytes, stats);
+}
+
+void benchMmap(const char* path, bool parse)
+{
+    PacketRecord records[kBatchSize];
+    Unit units[kBatchSize];
+    UnpackStats stats;
+    uint64_t packets = 0, bytes = 0;
+
+    auto start = Timestamp::now();
+    PcapFile file(path);
+    if (!file.valid()) {
+        printf("%s\n", file.error().c_str());
+        exit(1);
+    }
+
+    size_t n;
+    while ((n = file.read(records, kBatchSize)) > 0) {
+        packets += n;
+        for (size_t i = 0; i < n; i++)
+            bytes += records[i].caplen;
+        if (parse)
+            unpackBatch(records, n, file.linkType(), units,
+                        kVerifyChecksum, &stats);
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+
+    report(parse ? "mmap+batch" : "mmap", seconds, packets, bytes, stats);
+}
+
+}
+
+// run twice on the same trace to compare with a warm page cache,
+// or drop caches in between (echo 1 > /proc/sys/vm/drop_caches)
+// to compare cold reads
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        printf("./pcap_file_bench file\n");
+        exit(1);
+    }
+    const char* path = argv[1];
+
+    benchLibpcap(path, false);
+    benchMmap(path, false);
+    benchLibpcap(path, true);
+    benchMmap(path, true);
+}
@@ -0,0 +1,174 @@
+//
+// Created by frank on 18-2-8.
+//
+
+#include <thread>
+
+#include <eva/Pipeline.h>
+#include <eva/ResultSink.h>
+#include <eva/hash.h>
+
+using namespace eva;
+
+namespace
+{
+
+const uint32_t kSenderIP = 0x0100000a; // 10.0.0.1 in network order
+const uint32_t kMss = 1460;
+const int64_t  kRtt = 20 * 1000;
+const int64_t  kSpacing = 100;
+
+Unit makeUnit(int64_t when, uint32_t srcIP, uint32_t dstIP,
+              uint16_t srcPort, uint16_t dstPort, uint8_t flag)
+{
+    Unit u = Unit();
+    u.when = Timestamp(when);
+    u.srcIP = srcIP;
+    u.dstIP = dstIP;
+    u.srcPort = srcPort;
+    u.dstPort = dstPort;
+    u.flag = flag;
+    u.recvWindow = 65535;
+    u.hashCode = generateHashCode(srcIP, dstIP, srcPort, dstPort);
+    return u;
+}
+
+// a bulk transfer in slow start: every round trip sends a window of full
+// segments and every segment is acked one rtt later
+std::vector<Unit> makeFlow(uint32_t index, int rounds)
+{
+    uint32_t dstIP = htobe32(0x0b000000 + index);
+    uint16_t srcPort = htobe16(static_cast<uint16_t>(10000 + index % 50000));
+    uint16_t dstPort = htobe16(80);
+    int64_t now = 1500000000LL * Timestamp::kMicroSecondsPerSecond + index;
+    uint32_t seq = index * 7919;
+
+    std::vector<Unit> units;
+    auto syn = makeUnit(now, kSenderIP, dstIP, srcPort, dstPort, TH_SYN);
+    syn.dataSequence = seq++;
+    units.push_back(syn);
+
+    now += kRtt;
+    auto synAck = makeUnit(now, dstIP, kSenderIP, dstPort, srcPort,
+                           TH_SYN | TH_ACK);
+    synAck.ackSequence = seq;
+    synAck.seeMss = true;
+    synAck.mss = kMss;
+    synAck.seeWsc = true;
+    synAck.wsc = 7;
+    units.push_back(synAck);
+
+    uint32_t window = 10;
+    for (int r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < window; i++) {
+            auto data = makeUnit(now + i * kSpacing, kSenderIP, dstIP,
+                                 srcPort, dstPort, TH_ACK);
+            data.dataSequence = seq + i * kMss;
+            data.dataLength = kMss;
+            units.push_back(data);
+        }
+        for (uint32_t i = 0; i < window; i++) {
+            auto ack = makeUnit(now + kRtt + i * kSpacing, dstIP, kSenderIP,
+                                dstPort, srcPort, TH_ACK);
+            ack.ackSequence = seq + (i + 1) * kMss;
+            units.push_back(ack);
+        }
+        seq += window * kMss;
+        now += kRtt + window * kSpacing;
+        window = std::min(window * 2, 64u);
+    }
+
+    auto fin = makeUnit(now, kSenderIP, dstIP, srcPort, dstPort,
+                        TH_FIN | TH_ACK);
+    fin.dataSequence = seq;
+    units.push_back(fin);
+    return units;
+}
+
+// flows interleaved one unit at a time, as they would be on the wire
+std::vector<Unit> makeTrace(uint32_t nFlows, int rounds)
+{
+    std::vector<std::vector<Unit>> flows;
+    for (uint32_t i = 0; i < nFlows; i++)
+        flows.push_back(makeFlow(i, rounds));
+
+    std::vector<Unit> trace;
+    for (size_t step = 0; ; step++) {
+        bool more = false;
+        for (auto& flow: flows) {
+            if (step < flow.size()) {
+                trace.push_back(flow[step]);
+                more = true;
+            }
+        }
+        if (!more)
+            break;
+    }
+    return trace;
+}
+
+double bench(std::vector<Unit>& trace, size_t nThreads)
+{
+    const size_t kBatchSize = 64;
+
+    auto start = Timestamp::now();
+    Pipeline pipeline(nThreads, kSenderIP, 0);
+    for (size_t i = 0; i < trace.size(); i += kBatchSize) {
+        pipeline.dispatch(&trace[i], std::min(kBatchSize, trace.size() - i));
+    }
+    pipeline.finish();
+    return timeDifference(Timestamp::now(), start);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t nFlows = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 2000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    size_t maxThreads = argc > 3 ? strtoul(argv[3], nullptr, 10) :
+                        std::thread::hardware_concurrency();
+
+    // measure the pipeline, not the terminal
+    Logger::setLogLevel(Logger::FATAL);
+    Logger::setOutput([](const char*, int) {});
+    NullResultSink nullSink;
+    setResultSink(&nullSink);
+
+    auto trace = makeTrace(nFlows, rounds);
+    printf("%u flows, %lu units\n", nFlows, trace.size());
+
+    double base = 0;
+    for (size_t n = 1; n <= maxThreads; n *= 2) {
+        double seconds = bench(trace, n);
+        if (n == 1)
+            base = seconds;
+        printf("%2lu workers %7.1f ns/unit  %6.2f Munits/s  speedup %.2f\n",
+               n, seconds * 1e9 / static_cast<double>(trace.size()),
+               static_cast<double>(trace.size()) / seconds / 1e6,
+               base / seconds);
+    }
+
+    // the cost of reporting: results formatted and written to /dev/null
+    // by the default writer
+    FILE* devNull = fopen("/dev/null", "w");
+    if (devNull == nullptr) {
+        perror("fopen /dev/null");
+        return 1;
+    }
+    {
+        AsyncResultWriter writer(devNull);
+        for (size_t n = 1; n <= maxThreads; n *= 2) {
+            setResultSink(&nullSink);
+            double disabled = bench(trace, n);
+            setResultSink(&writer);
+            double enabled = bench(trace, n);
+            printf("%2lu workers  output disabled %9.0f flows/s  "
+                   "enabled %9.0f flows/s  %+.1f%%\n",
+                   n, nFlows / disabled, nFlows / enabled,
+                   (disabled / enabled - 1) * 100);
+        }
+        setResultSink(&nullSink);
+    }
+    fclose(devNull);
+}
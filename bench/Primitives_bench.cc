@@ -0,0 +1,129 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <random>
+
+#include <eva/Unit.h>
+#include <eva/checksum.h>
+#include <eva/hash.h>
+#include <eva/Screener.h>
+
+using namespace eva;
+
+namespace
+{
+
+// results are summed into it, so the compiler can not drop the work
+volatile uint64_t sink;
+
+void report(const char* name, double seconds, size_t n, const char* unit)
+{
+    printf("%-24s %7.2f ns/%s\n", name,
+           seconds * 1e9 / static_cast<double>(n), unit);
+}
+
+// verify the ip and tcp checksums of |n| crafted segments with |payload|
+// zero bytes each
+void benchChecksum(size_t n, uint32_t payload, int rounds)
+{
+    std::mt19937 gen(0);
+    std::vector<std::vector<unsigned char>> frames;
+    for (size_t i = 0; i < n; i++) {
+        Unit u = Unit();
+        u.srcIP = static_cast<uint32_t>(gen());
+        u.dstIP = static_cast<uint32_t>(gen());
+        u.srcPort = static_cast<uint16_t>(gen());
+        u.dstPort = static_cast<uint16_t>(gen());
+        u.dataSequence = static_cast<uint32_t>(gen());
+        u.ackSequence = static_cast<uint32_t>(gen());
+        u.recvWindow = 1024;
+        u.dataLength = payload;
+        u.flag = TH_ACK;
+
+        std::vector<unsigned char> frame(kMaxHeaderLength + payload);
+        frame.resize(packUnit(u, frame.data()) + payload);
+        frames.push_back(std::move(frame));
+    }
+
+    uint64_t valid = 0;
+    auto start = Timestamp::now();
+    for (int r = 0; r < rounds; r++) {
+        for (auto& frame: frames) {
+            const void* ip = frame.data() + 14;
+            auto iphdr = static_cast<const struct ip*>(ip);
+            const void* tcp = frame.data() + 14 + iphdr->ip_hl * 4;
+            valid += static_cast<uint64_t>(ipChecksumValid(iphdr));
+            valid += static_cast<uint64_t>(tcpChecksumValid(
+                    iphdr, static_cast<const struct tcphdr*>(tcp)));
+        }
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    sink += valid;
+
+    char name[64];
+    snprintf(name, sizeof(name), "checksum %u bytes", payload);
+    report(name, seconds, n * static_cast<size_t>(rounds), "segment");
+}
+
+void benchHashCode(size_t n, int rounds)
+{
+    std::mt19937 gen(0);
+    std::vector<Unit> units(n);
+    for (auto& u: units) {
+        u.srcIP = static_cast<uint32_t>(gen());
+        u.dstIP = static_cast<uint32_t>(gen());
+        u.srcPort = static_cast<uint16_t>(gen());
+        u.dstPort = static_cast<uint16_t>(gen());
+    }
+
+    uint64_t sum = 0;
+    auto start = Timestamp::now();
+    for (int r = 0; r < rounds; r++) {
+        for (auto& u: units)
+            sum += generateHashCode(u.srcIP, u.dstIP, u.srcPort, u.dstPort);
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    sink += sum;
+    report("generateHashCode", seconds, n * static_cast<size_t>(rounds),
+           "hash");
+}
+
+// delivery rate samples of a flow, one per ack, over round trips of
+// |acksPerRoundtrip| acks: the max filter of the analyzers
+void benchWindowedFilter(size_t n, uint32_t acksPerRoundtrip)
+{
+    std::mt19937 gen(0);
+    std::vector<int64_t> samples(n);
+    for (auto& sample: samples)
+        sample = 1000 + static_cast<int64_t>(gen() % 100000);
+
+    MaxBandwidthFilter filter(10, 0, 0);
+    uint32_t roundtrip = 0;
+    auto start = Timestamp::now();
+    for (size_t i = 0; i < n; i++) {
+        if (i % acksPerRoundtrip == 0)
+            roundtrip++;
+        filter.Update(samples[i], roundtrip);
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    sink += static_cast<uint64_t>(filter.GetBest());
+
+    char name[64];
+    snprintf(name, sizeof(name), "WindowedFilter %u/rtt", acksPerRoundtrip);
+    report(name, seconds, n, "update");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    int rounds = 10;
+
+    benchChecksum(n / 10, 0, rounds);
+    benchChecksum(n / 10, 1460, rounds);
+    benchHashCode(n, rounds);
+    benchWindowedFilter(n * static_cast<size_t>(rounds), 1);
+    benchWindowedFilter(n * static_cast<size_t>(rounds), 100);
+}
@@ -0,0 +1,87 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <eva/Pipeline.h>
+#include <eva/Capture.h>
+#include <eva/ResultSink.h>
+
+using namespace eva;
+
+namespace
+{
+
+const size_t kBatchSize = 64;
+
+// read, unpack and analyze a trace end to end as run/run2 do, with the
+// results dropped. the trace is read once before, so it comes from the
+// page cache
+void replay(const char* path, uint32_t srcIP, uint32_t dstIP,
+            size_t nThreads, bool duplex, bool screen)
+{
+    auto source = openPacketSource(path);
+    if (source == nullptr)
+        exit(1);
+    int linkType = source->linkType();
+
+    PacketRecord records[kBatchSize];
+    Unit units[kBatchSize];
+    UnpackStats stats;
+    Pipeline pipeline(nThreads, srcIP, dstIP, FlowTimeouts(), duplex, screen);
+
+    auto start = Timestamp::now();
+    size_t n;
+    while ((n = source->read(records, kBatchSize)) > 0) {
+        size_t nUnits = unpackBatch(records, n, linkType, units,
+                                    kTrustChecksum, &stats);
+        pipeline.dispatch(units, nUnits);
+    }
+    pipeline.finish();
+    double seconds = timeDifference(Timestamp::now(), start);
+
+    printf("%lu threads %-7s %-6s %7.1f ns/packet  %6.2f Mpps  "
+           "%lu flows  ", nThreads, duplex ? "duplex" : "simplex",
+           screen ? "screen" : "full",
+           seconds * 1e9 / static_cast<double>(stats.packets),
+           static_cast<double>(stats.packets) / seconds / 1e6,
+           pipeline.flowCount());
+    stats.print(stdout);
+}
+
+void warmUp(const char* path)
+{
+    auto source = openPacketSource(path);
+    if (source == nullptr)
+        exit(1);
+    PacketRecord records[kBatchSize];
+    while (source->read(records, kBatchSize) > 0)
+        ;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3 || argc > 5) {
+        printf("./replay_bench file srcAddress [dstAddress [threads]]\n");
+        exit(1);
+    }
+
+    uint32_t srcIP, dstIP = 0;
+    if (!parseIPv4(argv[2], &srcIP) ||
+        (argc >= 4 && !parseIPv4(argv[3], &dstIP))) {
+        exit(1);
+    }
+    size_t maxThreads = argc >= 5 ? strtoul(argv[4], nullptr, 10) : 1;
+
+    Logger::setLogLevel(Logger::FATAL);
+    NullResultSink nullSink;
+    setResultSink(&nullSink);
+
+    warmUp(argv[1]);
+    for (size_t nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+        replay(argv[1], srcIP, dstIP, nThreads, false, false);
+        replay(argv[1], srcIP, dstIP, nThreads, true, false);
+        replay(argv[1], srcIP, dstIP, nThreads, false, true);
+    }
+}
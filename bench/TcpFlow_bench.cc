@@ -0,0 +1,260 @@
+//
+// Created by frank on 18-2-9.
+//
+
+
+#include <eva/Analyzer.h>
+#include <eva/ResultSink.h>
+
+using namespace eva;
+
+namespace
+{
+
+const uint32_t kMss = 1460;
+const int64_t  kRtt = 50 * 1000;
+const int64_t  kSpacing = 10;
+
+class Sender
+{
+public:
+    explicit Sender(size_t window)
+            : window_(window),
+              now_(1500000000LL * Timestamp::kMicroSecondsPerSecond),
+              seq_(1),
+              acked_(seq_)
+    {
+        unit_ = Unit();
+        unit_.srcIP = 0x0100000a;
+        unit_.dstIP = 0x0200000a;
+        unit_.srcPort = htobe16(10000);
+        unit_.dstPort = htobe16(80);
+        unit_.recvWindow = 65535;
+
+        Unit syn = data(TH_SYN, seq_, 0);
+        analyzer_.reset(new Analyzer(DataUnit(&syn)));
+        analyzer_->onDataUnit(DataUnit(&syn));
+        seq_++;
+
+        Unit synAck = ack(TH_SYN | TH_ACK, seq_);
+        synAck.seeMss = true;
+        synAck.mss = kMss;
+        synAck.seeWsc = true;
+        synAck.wsc = 14;
+        analyzer_->onAckUnit(AckUnit(&synAck));
+        acked_ = seq_;
+    }
+
+    // put a window of full segments in flight
+    void sendWindow()
+    {
+        for (size_t i = 0; i < window_; i++) {
+            Unit u = data(TH_ACK, seq_, kMss);
+            analyzer_->onDataUnit(DataUnit(&u));
+            seq_ += kMss;
+        }
+    }
+
+    // one cumulative ack per segment, time them only
+    double ackWindow()
+    {
+        now_ += kRtt;
+        auto start = Timestamp::now();
+        for (size_t i = 0; i < window_; i++) {
+            acked_ += kMss;
+            Unit u = ack(TH_ACK, acked_);
+            analyzer_->onAckUnit(AckUnit(&u));
+        }
+        return timeDifference(Timestamp::now(), start);
+    }
+
+    // every |lossEvery|th segment of the window is lost, starting with the
+    // first one. each arriving segment is answered by a dup ack whose SACK
+    // blocks cover the newest runs, newest first, as a receiver would send
+    // them. then the holes are retransmitted, and each retransmit is acked.
+    // time the acks only
+    double ackWindowWithLoss(size_t lossEvery)
+    {
+        const uint32_t una = acked_;
+        const size_t kRunLength = lossEvery - 1;
+
+        now_ += kRtt;
+        auto start = Timestamp::now();
+        for (size_t i = 1; i < window_; i++) {
+            if (i % lossEvery == 0)
+                continue;
+            Unit u = ack(TH_ACK, una);
+            size_t runStart = i - i % lossEvery + 1;
+            size_t runEnd = i + 1;
+            for (;;) {
+                u.sackBlock[u.sackCount].leftEdge = una + sequenceOffset(runStart);
+                u.sackBlock[u.sackCount].rightEdge = una + sequenceOffset(runEnd);
+                u.sackCount++;
+                if (u.sackCount == 3 || runStart < lossEvery)
+                    break;
+                runEnd = runStart - 1;
+                runStart = runEnd - kRunLength;
+            }
+            analyzer_->onAckUnit(AckUnit(&u));
+        }
+        double seconds = timeDifference(Timestamp::now(), start);
+
+        for (size_t i = 0; i < window_; i += lossEvery) {
+            Unit u = data(TH_ACK, una + sequenceOffset(i), kMss);
+            analyzer_->onDataUnit(DataUnit(&u));
+        }
+
+        now_ += kRtt;
+        start = Timestamp::now();
+        for (size_t i = 0; i < window_; i += lossEvery) {
+            acked_ = una + sequenceOffset(std::min(i + lossEvery, window_));
+            Unit u = ack(TH_ACK, acked_);
+            analyzer_->onAckUnit(AckUnit(&u));
+        }
+        return seconds + timeDifference(Timestamp::now(), start);
+    }
+
+    // the whole window times out and is sent again in units of |length|
+    // bytes, which need not line up with the original segments. time the
+    // retransmits only, then ack everything
+    double rexmitWindow(uint32_t length)
+    {
+        const uint32_t una = acked_;
+        const uint32_t bytes = sequenceOffset(window_);
+
+        now_ += 4 * kRtt;
+        auto start = Timestamp::now();
+        for (uint32_t offset = 0; offset < bytes; offset += length) {
+            Unit u = data(TH_ACK, una + offset, std::min(length, bytes - offset));
+            analyzer_->onDataUnit(DataUnit(&u));
+        }
+        double seconds = timeDifference(Timestamp::now(), start);
+
+        now_ += kRtt;
+        acked_ = una + bytes;
+        Unit u = ack(TH_ACK, acked_);
+        analyzer_->onAckUnit(AckUnit(&u));
+        return seconds;
+    }
+
+    const Analyzer& analyzer() const { return *analyzer_; }
+
+private:
+    static uint32_t sequenceOffset(size_t segments)
+    {
+        return static_cast<uint32_t>(segments) * kMss;
+    }
+
+    Unit data(uint8_t flag, uint32_t sequence, uint32_t length)
+    {
+        Unit u = unit_;
+        u.when = Timestamp(now_ += kSpacing);
+        u.flag = flag;
+        u.dataSequence = sequence;
+        u.dataLength = length;
+        return u;
+    }
+
+    Unit ack(uint8_t flag, uint32_t ackSequence)
+    {
+        Unit u = unit_;
+        std::swap(u.srcIP, u.dstIP);
+        std::swap(u.srcPort, u.dstPort);
+        u.when = Timestamp(now_ += kSpacing);
+        u.flag = flag;
+        u.ackSequence = ackSequence;
+        return u;
+    }
+
+    const size_t window_;
+    int64_t now_;
+    uint32_t seq_;
+    uint32_t acked_;
+    Unit unit_;
+    std::unique_ptr<Analyzer> analyzer_;
+};
+
+enum Mode
+{
+    kCumulative,
+    kSack,
+    kRexmit,
+    kResegmentedRexmit,
+};
+
+const char* modeNames[] = {
+    "cumulative",
+    "sack",
+    "rexmit",
+    "resegment",
+};
+
+void bench(size_t window, size_t operations, Mode mode, size_t lossEvery)
+{
+    Sender sender(window);
+    double seconds = 0;
+    size_t n = 0;
+    while (n < operations) {
+        sender.sendWindow();
+        switch (mode) {
+            case kCumulative:
+                seconds += sender.ackWindow();
+                n += window;
+                break;
+            case kSack:
+                seconds += sender.ackWindowWithLoss(lossEvery);
+                n += window;
+                break;
+            case kRexmit:
+                seconds += sender.rexmitWindow(kMss);
+                n += window;
+                break;
+            case kResegmentedRexmit:
+                // 2.5 segments, most retransmits start inside a segment
+                seconds += sender.rexmitWindow(kMss * 5 / 2);
+                n += (window * 2 + 4) / 5;
+                break;
+        }
+    }
+    printf("window %7lu segments  %-10s %8.1f ns/%s\n",
+           window, modeNames[mode],
+           seconds * 1e9 / static_cast<double>(n),
+           mode == kCumulative || mode == kSack ? "ack" : "rexmit");
+}
+
+// analyzer bytes with a full window in flight
+void reportMemory(size_t window)
+{
+    Sender sender(window);
+    sender.sendWindow();
+    auto& analyzer = sender.analyzer();
+    printf("window %7lu segments  memory %10lu bytes/flow  %5.1f bytes/segment\n",
+           window, analyzer.memoryUsage(),
+           static_cast<double>(analyzer.memoryUsage()) /
+           static_cast<double>(analyzer.inflightCount()));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t operations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+    size_t maxWindow = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+    // one loss in every 100 segments
+    size_t lossEvery = argc > 3 ? strtoul(argv[3], nullptr, 10) : 100;
+
+    Logger::setLogLevel(Logger::FATAL);
+    Logger::setOutput([](const char*, int) {});
+    NullResultSink nullSink;
+    setResultSink(&nullSink);
+
+    printf("%lu bytes per unit in flight, %lu bytes per analyzer\n",
+           Analyzer::unitSize(), sizeof(Analyzer));
+    for (size_t window = 100; window <= maxWindow; window *= 10)
+        reportMemory(window);
+
+    for (int mode = kCumulative; mode <= kResegmentedRexmit; mode++) {
+        for (size_t window = 100; window <= maxWindow; window *= 10)
+            bench(window, operations, static_cast<Mode>(mode), lossEvery);
+    }
+}
@@ -0,0 +1,157 @@
+//
+// Created by frank on 18-2-4.
+//
+
+#include <random>
+
+#include <eva/Unit.h>
+#include <eva/PacketSource.h>
+#include <eva/checksum.h>
+#include <eva/Exception.h>
+
+using namespace eva;
+
+namespace
+{
+
+struct Trace
+{
+    std::vector<pcap_pkthdr> headers;
+    std::vector<std::vector<unsigned char>> frames;
+};
+
+// half of the frames are tcp segments, the other half udp datagrams
+Trace makeTrace(size_t n, uint32_t payload)
+{
+    std::mt19937 gen(0);
+    Trace trace;
+
+    for (size_t i = 0; i < n; i++) {
+        Unit u;
+        u.srcIP = static_cast<uint32_t>(gen());
+        u.dstIP = static_cast<uint32_t>(gen());
+        u.srcPort = static_cast<uint16_t>(gen());
+        u.dstPort = static_cast<uint16_t>(gen());
+        u.dataSequence = static_cast<uint32_t>(gen());
+        u.ackSequence = static_cast<uint32_t>(gen());
+        u.recvWindow = 1024;
+        u.dataLength = payload;
+        u.flag = TH_ACK;
+        u.seeMss = false;
+        u.seeWsc = false;
+        u.sackCount = 0;
+
+        std::vector<unsigned char> frame(kMaxHeaderLength + payload);
+        uint32_t len = packUnit(u, frame.data()) + payload;
+        frame.resize(len);
+
+        if (i % 2 == 1) {
+            void* any = frame.data() + 14;
+            auto iphdr = static_cast<struct ip*>(any);
+            iphdr->ip_p = IPPROTO_UDP;
+            setIpChecksum(iphdr);
+        }
+
+        pcap_pkthdr hdr;
+        hdr.ts.tv_sec = static_cast<time_t>(i / 1000);
+        hdr.ts.tv_usec = static_cast<suseconds_t>(i % 1000);
+        hdr.caplen = hdr.len = len;
+
+        trace.headers.push_back(hdr);
+        trace.frames.push_back(std::move(frame));
+    }
+    return trace;
+}
+
+// the way unpack() reported errors before, one throw per dropped frame
+bool unpackThrow(pcap_pkthdr* hdr, const unsigned char* data, Unit* u)
+{
+    try {
+        UnpackError error = unpackUnit(hdr, data, DLT_EN10MB, u);
+        if (error != kUnpackOk)
+            throw Exception(unpackErrorString(error));
+    }
+    catch (Exception& e) {
+        return false;
+    }
+    return true;
+}
+
+void report(const char* name, double seconds, double packets,
+            const UnpackStats& stats)
+{
+    printf("%-10s %7.1f ns/packet  %6.2f Mpps  ", name,
+           seconds * 1e9 / packets, packets / seconds / 1e6);
+    stats.print(stdout);
+}
+
+void bench(const char* name, Trace& trace, int rounds, bool throwing)
+{
+    UnpackStats stats;
+    Unit u;
+    size_t n = trace.headers.size();
+
+    auto start = Timestamp::now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            auto hdr = &trace.headers[i];
+            auto data = trace.frames[i].data();
+            if (throwing) {
+                bool ok = unpackThrow(hdr, data, &u);
+                stats.add(ok ? kUnpackOk : kNotTcp);
+            }
+            else {
+                stats.add(unpackUnit(hdr, data, DLT_EN10MB, &u));
+            }
+        }
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    report(name, seconds, static_cast<double>(n) * rounds, stats);
+}
+
+// |snaplen| cuts the records like a header only capture would
+void benchBatch(const char* name, Trace& trace, int rounds, uint32_t snaplen)
+{
+    const size_t kBatchSize = 64;
+
+    size_t n = trace.headers.size();
+    std::vector<PacketRecord> records(n);
+    for (size_t i = 0; i < n; i++) {
+        auto& hdr = trace.headers[i];
+        records[i].when = hdr.ts.tv_sec * Timestamp::kMicroSecondsPerSecond +
+                          hdr.ts.tv_usec;
+        records[i].caplen = std::min(hdr.caplen, snaplen);
+        records[i].len = hdr.len;
+        records[i].data = trace.frames[i].data();
+    }
+
+    UnpackStats stats;
+    Unit units[kBatchSize];
+
+    auto start = Timestamp::now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i += kBatchSize) {
+            unpackBatch(&records[i], std::min(kBatchSize, n - i), DLT_EN10MB,
+                        units, kVerifyChecksum, &stats);
+        }
+    }
+    double seconds = timeDifference(Timestamp::now(), start);
+    report(name, seconds, static_cast<double>(n) * rounds, stats);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    uint32_t payload = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 0;
+    int rounds = 20;
+
+    auto trace = makeTrace(n, payload);
+    printf("%lu frames, 50%% non-tcp, %u payload bytes\n", n, payload);
+
+    bench("exception", trace, rounds, true);
+    bench("error code", trace, rounds, false);
+    benchBatch("batch", trace, rounds, kFullSnaplen);
+    benchBatch("headers", trace, rounds, kHeaderSnaplen);
+}
@@ -10,6 +10,8 @@
 #include <memory>
 
 #include <eva/Analyzer.h>
+#include <eva/Capture.h>
+#include <eva/PcapFile.h>
 
 using namespace eva;
 
@@ -54,42 +56,52 @@ int main(int argc, char** argv)
 
     printf("%s %s\n", srcAddress, interface);
 
-    char errbuf[PCAP_ERRBUF_SIZE];
-    pcap* cap = pcap_open_offline(file, errbuf);
-    if (cap == nullptr) {
-        printf("%s\n", errbuf);
+    uint32_t srcIP;
+    if (!parseIPv4(srcAddress, &srcIP)) {
         exit(1);
     }
 
-    int linkType = pcap_datalink(cap);
-    if (linkType == PCAP_ERROR_NOT_ACTIVATED) {
-        printf("%s\n", errbuf);
+    PcapFile source(file);
+    if (!source.valid()) {
+        printf("%s\n", source.error().c_str());
         exit(1);
     }
+    int linkType = source.linkType();
 
-    struct pcap_pkthdr hdr;
-    const uint8_t* data;
-
-    Counter cnt;
-    while ((data = pcap_next(cap, &hdr)) != nullptr) {
-
-        eva::Unit u;
-        bool ok = eva::unpack(&hdr, data, linkType, &u);
-        if (!ok) {
-            continue;
-        }
-        if (u.srcAddress.toIp() == srcAddress) {
+    char filter[64];
+    snprintf(filter, sizeof(filter), "tcp and src host %s", srcAddress);
+    if (!source.setFilter(filter)) {
+        exit(1);
+    }
 
-            uint32_t expect = 1500 - 40 - u.optionLength;
-            uint32_t len = u.dataLength;
+    const size_t kBatchSize = 64;
+    PacketRecord records[kBatchSize];
+    eva::Unit units[kBatchSize];
 
-            while (len > expect) {
-                cnt.put(expect);
-                len -= expect;
+    Counter cnt;
+    UnpackStats unpackStats;
+    size_t n;
+    while ((n = source.read(records, kBatchSize)) > 0) {
+
+        size_t nUnits = unpackBatch(records, n, linkType, units,
+                                    kTrustChecksum, &unpackStats);
+        for (size_t i = 0; i < nUnits; i++) {
+
+            eva::Unit& u = units[i];
+            if (u.srcIP == srcIP) {
+
+                uint32_t expect = segmentPayload(kEthernetMss, u.optionLength);
+                uint32_t len = u.dataLength;
+
+                while (len > expect) {
+                    cnt.put(expect);
+                    len -= expect;
+                }
+                if (len > 0)
+                    cnt.put(len);
             }
-            if (len > 0)
-                cnt.put(len);
         }
     }
     cnt.print();
+    unpackStats.print(stderr);
 }
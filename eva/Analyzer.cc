@@ -2,62 +2,38 @@
 // Created by frank on 18-1-2.
 //
 
-#include <iostream>
 #include <numeric>
 
 #include <eva/Analyzer.h>
+#include <eva/ResultSink.h>
 
 using namespace eva;
 
-namespace
+Analyzer::~Analyzer()
 {
+    // a flow with no round trip has no totals, nor counts as a flow
+    if (!reported_)
+        return;
 
-const int64_t kRtpropExpration = 30 * Timestamp::kMicroSecondsPerSecond;
-
-enum {
-    kSlowStart,
-    kApplication,
-    kSendBuffer,
-    kCongestionControl,
-    kReceiveWindow,
-    kBandwidth,
-    kCongestion,
-    kBufferbloat,
-    kNOutput,
-};
-
-bool started = false;
-Timestamp start_time, end_time;
-
-std::vector<int64_t> duration_per_limit(kNOutput);
-
-std::vector<int64_t> bytes_per_limit(kNOutput);
-
-std::vector<int64_t> flight_per_limit(kNOutput);
-
-}
+    FlowResult result;
+    result.srcIP = srcAddress().ipNetEndian();
+    result.dstIP = dstAddress().ipNetEndian();
+    result.srcPort = srcAddress().toPort();
+    result.dstPort = dstAddress().toPort();
+    result.totals = totals_;
+    resultSink().onFlowTotals(result);
 
-Analyzer::~Analyzer()
-{
-    for (auto d: duration_per_limit) {
-        std::cout << d << " ";
-    }
-    std::cout << "   ";
-    for (auto b: bytes_per_limit) {
-        std::cout << b << " ";
-    }
-    std::cout << "   ";
-    for (auto f: flight_per_limit) {
-        std::cout << f << " ";
-    }
-    std::cout << "\n";
+    if (aggregate_ != nullptr)
+        aggregate_->onFlowEnd();
 }
 
-
 void Analyzer::onRateSample(const RateSample& rs, const AckUnit& ackUnit)
 {
     assert(rs.ackReceivedTime.valid());
     assert(rs.dataSentTime.valid());
+    EVA_TRACE_EVENT(kTraceRateSample, rs.ackReceivedTime,
+                    srcAddress(), dstAddress(), roundtripCount(),
+                    rs.rtt, rs.deliveryRate);
 
     bool rttIsValid = (!rs.seeRexmit && !ackUnit.u->isSACK()) ||
                        rs.rtt > rtprop_;
@@ -67,7 +43,7 @@ void Analyzer::onRateSample(const RateSample& rs, const AckUnit& ackUnit)
 
     if (rtprop_ < 0 ||
         (rttIsValid && rtprop_ > rs.rtt) ||
-        rs.ackReceivedTime - rtpropTimestamp_ >= kRtpropExpration)
+        rs.ackReceivedTime - rtpropTimestamp_ >= kRtpropExpiration)
     {
         rtprop_ = rs.rtt;
         rtpropTimestamp_ = rs.ackReceivedTime;
@@ -150,29 +126,18 @@ void Analyzer::onNewRoundtrip(Timestamp now,
         return;
     }
 
-    // update global information
-    int64_t duration = (now - firstAckTime_) / 1000;
-    if (!started) {
-        started = true;
-        start_time = firstAckTime_;
-        end_time = now;
-    }
-    else {
-        end_time = now;
-    }
-
-    std::cout.width(6);
-    std::cout << " [" << roundtripCount() << "]"
-              << " " << bandwidthFilter_.GetBest() << "kB/s"
-              << " " << rtprop_ << "us "
-              << extractHours(firstAckTime_) << " -> "
-              << extractHours(now) << " ";
+    RoundtripResult result;
+    result.start = firstAckTime_.microSecondsSinceEpoch();
+    result.end = now.microSecondsSinceEpoch();
+    result.btlbw = bandwidthFilter_.GetBest();
+    result.rtprop = rtprop_;
+    result.roundtrip = roundtripCount();
+    result.votes = 0;
+    result.total = 0;
 
     if (rttHugeCount_ == ackCount_) {
-        std::cout << "[buffer bloat]\n";
-        duration_per_limit[kBufferbloat] += duration;
-        bytes_per_limit[kBufferbloat] += currFlightSize;
-        flight_per_limit[kBufferbloat]++;
+        result.limit = kBufferbloat;
+        report(result, currFlightSize);
         AfterRoundTrip(currFlightSize);
         return;
     }
@@ -214,23 +179,14 @@ void Analyzer::onNewRoundtrip(Timestamp now,
             ret = SENDER_LIMITED;
     }
 
+    RoundtripLimit limit;
     switch (ret)
     {
         case SLOW_STAR_LIMITED:
-            std::cout << "[slow start]"
-                      << " (" << votes_[ret] << "/" << total << ")"
-                      << "\n";
-            duration_per_limit[kSlowStart] += duration;
-            bytes_per_limit[kSlowStart] += currFlightSize;
-            flight_per_limit[kSlowStart]++;
+            limit = kSlowStart;
             break;
         case BANDWIDTH_LIMITED:
-            std::cout << "[bandwidth limited]"
-                          << " (" << votes_[ret] << "/" << total << ")"
-                          << "\n";
-            duration_per_limit[kBandwidth] += duration;
-            bytes_per_limit[kBandwidth] += currFlightSize;
-            flight_per_limit[kBandwidth]++;
+            limit = kBandwidth;
             break;
         case SENDER_LIMITED: {
 
@@ -244,60 +200,44 @@ void Analyzer::onNewRoundtrip(Timestamp now,
                  smallUnitCount_ == 0 ||
                  allZero))
             {
-                if (allZero) {
-                    std::cout << "(buffer)";
-                    duration_per_limit[kSendBuffer] += duration;
-                    bytes_per_limit[kSendBuffer] += currFlightSize;
-                    flight_per_limit[kSendBuffer]++;
-                }
-                else {
-                    std::cout << "(cc)";
-                    duration_per_limit[kCongestionControl] += duration;
-                    bytes_per_limit[kCongestionControl] += currFlightSize;
-                    flight_per_limit[kCongestionControl]++;
-                }
-                std::cout << "[kernel limited]"
-                          << " (" << votes_[ret] << "/" << total << ")"
-                          << "\n";
+                // kernel limited, by the send buffer or by cc
+                limit = allZero ? kSendBuffer : kCongestionControl;
             } else {
-                std::cout << "[application limited]"
-                          << " (" << votes_[ret] << "/" << total << ")"
-                          << "\n";
-                duration_per_limit[kApplication] += duration;
-                bytes_per_limit[kApplication] += currFlightSize;
-                flight_per_limit[kApplication]++;
+                limit = kApplication;
             }
         }
             break;
         case RECEIVER_LIMITED:
-            std::cout
-                    << "[receiver limited]"
-                    << " (" << votes_[ret] << "/" << total << ")"
-                    << "\n";
-            duration_per_limit[kReceiveWindow] += duration;
-            bytes_per_limit[kReceiveWindow] += currFlightSize;
-            flight_per_limit[kReceiveWindow]++;
-
+            limit = kReceiveWindow;
             break;
         case CONGESTION_LIMITED:
-            std::cout
-                    << "[congestion limited]"
-                    << " (" << votes_[ret] << "/" << total << ")"
-                    << "\n";
-            duration_per_limit[kCongestion] += duration;
-            bytes_per_limit[kCongestion] += currFlightSize;
-            flight_per_limit[kCongestion]++;
+            limit = kCongestion;
             break;
         default:
-            std::cout
-                    << "[unknown limited]"
-                    << " (" << votes_[ret] << "/" << total << ")"
-                    << "\n";
+            limit = kUnknownLimit;
             break;
     }
+
+    result.limit = static_cast<uint8_t>(limit);
+    result.votes = votes_[ret];
+    result.total = total;
+    report(result, currFlightSize);
     AfterRoundTrip(currFlightSize);
 }
 
+void Analyzer::report(const RoundtripResult& result, int32_t flightSize)
+{
+    auto limit = static_cast<RoundtripLimit>(result.limit);
+    if (limit != kUnknownLimit)
+        totals_.add(limit, (result.end - result.start) / 1000, flightSize);
+    if (aggregate_ != nullptr)
+        aggregate_->add(serverPort_, limit,
+                        result.start, result.end, flightSize);
+    reported_ = true;
+
+    resultSink().onRoundtrip(result);
+}
+
 void Analyzer::AfterRoundTrip(int32_t currFlightSize)
 {
     std::fill(votes_.begin(), votes_.end(), 0);
@@ -316,12 +256,13 @@ void Analyzer::AfterRoundTrip(int32_t currFlightSize)
 
 void Analyzer::onTimeoutRxmit(Timestamp first, Timestamp rexmit)
 {
-    std::cout << "[" << roundtripCount() << "]"
-              << " " << bandwidthFilter_.GetBest() << "kB/s"
-              << " " << rtprop_ << "us "
-              << extractHours(first) << " -> "
-              << extractHours(rexmit)
-              << " [timeout rexmit]" << "\n";
+    TimeoutResult result;
+    result.first = first.microSecondsSinceEpoch();
+    result.rexmit = rexmit.microSecondsSinceEpoch();
+    result.btlbw = bandwidthFilter_.GetBest();
+    result.rtprop = rtprop_;
+    result.roundtrip = roundtripCount();
+    resultSink().onTimeoutRexmit(result);
 }
 
 void Analyzer::onQuitSlowStart(Timestamp when)
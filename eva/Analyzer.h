@@ -6,9 +6,11 @@
 #define EVA_ANALYZER_H
 
 #include <atomic>
+#include <array>
 
 #include <eva/TcpFlow.h>
-#include <eva/Filter.h>
+#include <eva/Screener.h>
+#include <eva/ResultAggregate.h>
 
 namespace eva
 {
@@ -29,42 +31,62 @@ enum Result
 class Analyzer: public TcpFlow<Analyzer>
 {
 public:
-    explicit Analyzer(const DataUnit& dat):
+    explicit Analyzer(const DataUnit& dat,
+                      ResultAggregate* aggregate = nullptr):
             TcpFlow(dat),
             bandwidthFilter_(10, 0, 0),
             rtprop_(-1),
             rtpropTimestamp_(Timestamp::invalid()),
-            votes_(N_RESULT_TYPES),
             maxDeliveryRate_(0),
+            votes_(),
             smallUnitCount_(0),
-            prevSmallUnitCount_(0),
-            prevFlightSize1_(0),
-            prevFlightSize2_(0),
-            prevFlightSize3_(0),
             rttTooLongCount_(0),
             rttHugeCount_(0),
             ackCount_(0),
             seeRexmit_(false),
-            isSlowStart_(true)
+            isSlowStart_(true),
+            prevSmallUnitCount_(0),
+            prevFlightSize1_(0),
+            prevFlightSize2_(0),
+            prevFlightSize3_(0),
+            aggregate_(aggregate),
+            serverPort_(ResultAggregate::serverPort(srcAddress(),
+                                                    dstAddress())),
+            totals_(),
+            reported_(false)
     {}
 
-    explicit Analyzer(const AckUnit& ack):
+    explicit Analyzer(const AckUnit& ack,
+                      ResultAggregate* aggregate = nullptr):
             TcpFlow(ack),
             bandwidthFilter_(10, 0, 0),
             rtprop_(-1),
             rtpropTimestamp_(Timestamp::invalid()),
-            votes_(N_RESULT_TYPES),
             maxDeliveryRate_(0),
+            votes_(),
             smallUnitCount_(0),
-            prevSmallUnitCount_(0),
-            prevFlightSize1_(0),
-            prevFlightSize2_(0),
-            prevFlightSize3_(0),
             rttTooLongCount_(0),
             rttHugeCount_(0),
             ackCount_(0),
             seeRexmit_(false),
-            isSlowStart_(true)
+            isSlowStart_(true),
+            prevSmallUnitCount_(0),
+            prevFlightSize1_(0),
+            prevFlightSize2_(0),
+            prevFlightSize3_(0),
+            aggregate_(aggregate),
+            serverPort_(ResultAggregate::serverPort(srcAddress(),
+                                                    dstAddress())),
+            totals_(),
+            reported_(false)
+    {}
+
+    // take over a flow the screener found anomalous. the path model and
+    // the slow start state carry over, votes start with the next round.
+    // the model is copied out of the screener before the base moves it
+    explicit Analyzer(Screener&& screener,
+                      ResultAggregate* aggregate = nullptr):
+            Analyzer(std::move(screener), screener.pathModel(), aggregate)
     {}
 
     ~Analyzer();
@@ -83,38 +105,63 @@ public:
     int64_t bdp() const;
 
 private:
+    Analyzer(Screener&& screener, const PathModel& model,
+             ResultAggregate* aggregate):
+            TcpFlow(std::move(screener)),
+            bandwidthFilter_(model.bandwidthFilter),
+            rtprop_(model.rtprop),
+            rtpropTimestamp_(model.rtpropTimestamp),
+            slowStartQuitTime(model.slowStartQuitTime),
+            maxDeliveryRate_(0),
+            votes_(),
+            smallUnitCount_(0),
+            rttTooLongCount_(0),
+            rttHugeCount_(0),
+            ackCount_(0),
+            seeRexmit_(false),
+            isSlowStart_(model.isSlowStart),
+            prevSmallUnitCount_(0),
+            prevFlightSize1_(0),
+            prevFlightSize2_(0),
+            prevFlightSize3_(0),
+            aggregate_(aggregate),
+            serverPort_(ResultAggregate::serverPort(srcAddress(),
+                                                    dstAddress())),
+            totals_(),
+            reported_(false)
+    {}
+
     Result countVotes();
+    void report(const RoundtripResult& result, int32_t flightSize);
 
 private:
-    typedef WindowedFilter<
-            int64_t,
-            MaxFilter<int64_t>,
-            uint32_t,
-            uint32_t>
-            MaxBandwidthFilter;
-
+    // updated by every rate sample, right after the flow's lines
     MaxBandwidthFilter bandwidthFilter_;
     int64_t   rtprop_;
     Timestamp rtpropTimestamp_;
-    std::vector<int> votes_;
-
-    int64_t maxDeliveryRate_;
-
+    Timestamp firstAckTime_;   // first ack time in this round trip
+    Timestamp slowStartQuitTime;
+    int64_t   maxDeliveryRate_;
+    std::array<int, N_RESULT_TYPES> votes_;
     int smallUnitCount_;
-    int prevSmallUnitCount_;
-    int32_t prevFlightSize1_;
-    int32_t prevFlightSize2_;
-    int32_t prevFlightSize3_;
     int rttTooLongCount_;
     int rttHugeCount_;
     int ackCount_;
-
-
-    Timestamp firstAckTime_;   // first ack time in this round trip
-
     bool seeRexmit_;
     bool isSlowStart_;
-    Timestamp slowStartQuitTime;
+
+    // updated once per round trip
+    int prevSmallUnitCount_;
+    int32_t prevFlightSize1_;
+    int32_t prevFlightSize2_;
+    int32_t prevFlightSize3_;
+
+    // the round trips roll up into the worker's aggregate, if any
+    ResultAggregate* aggregate_;
+    uint16_t serverPort_;
+    // the round trips of this flow, reported as it ends
+    ResultTotals totals_;
+    bool reported_;
 };
 
 }
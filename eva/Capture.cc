@@ -0,0 +1,144 @@
+//
+// Created by frank on 18-2-3.
+//
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <string.h>
+
+#include <eva/Capture.h>
+#include <eva/PcapFile.h>
+
+namespace eva
+{
+
+bool parseIPv4(const char* ip, uint32_t* addr)
+{
+    struct in_addr in;
+    if (inet_pton(AF_INET, ip, &in) != 1) {
+        LOG_ERROR << "bad ipv4 address " << ip;
+        return false;
+    }
+    *addr = in.s_addr;
+    return true;
+}
+
+bool parseChecksumMode(const char* mode, ChecksumMode* checksumMode)
+{
+    if (strcmp(mode, "verify") == 0)
+        *checksumMode = kVerifyChecksum;
+    else if (strcmp(mode, "sample") == 0)
+        *checksumMode = kSampleChecksum;
+    else if (strcmp(mode, "trust") == 0)
+        *checksumMode = kTrustChecksum;
+    else {
+        LOG_ERROR << "bad checksum mode " << mode
+                  << ", should be verify, sample or trust";
+        return false;
+    }
+    return true;
+}
+
+bool setCaptureFilter(pcap_t* cap, const char* expression)
+{
+    struct bpf_program program;
+    if (pcap_compile(cap, &program, expression, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        LOG_ERROR << "pcap_compile \"" << expression << "\": " << pcap_geterr(cap);
+        return false;
+    }
+
+    bool ok = pcap_setfilter(cap, &program) == 0;
+    if (!ok) {
+        LOG_ERROR << "pcap_setfilter \"" << expression << "\": " << pcap_geterr(cap);
+    }
+    pcap_freecode(&program);
+    return ok;
+}
+
+PcapSource::PcapSource(pcap_t* cap, bool live)
+        : cap_(cap),
+          live_(live),
+          linkType_(pcap_datalink(cap))
+{
+}
+
+PcapSource::~PcapSource()
+{
+    pcap_close(cap_);
+}
+
+size_t PcapSource::read(PacketRecord* records, size_t n)
+{
+    if (n == 0)
+        return 0;
+
+    struct pcap_pkthdr* hdr;
+    const unsigned char* data;
+    int ret;
+    do {
+        // 0 is a read timeout of live capture
+        ret = pcap_next_ex(cap_, &hdr, &data);
+    } while (ret == 0);
+
+    if (ret < 0) {
+        if (ret == -1)
+            LOG_ERROR << "pcap_next_ex: " << pcap_geterr(cap_);
+        return 0;
+    }
+
+    records[0].when = hdr->ts.tv_sec * Timestamp::kMicroSecondsPerSecond +
+                      hdr->ts.tv_usec;
+    records[0].caplen = hdr->caplen;
+    records[0].len = hdr->len;
+    records[0].data = data;
+    return 1;
+}
+
+bool PcapSource::setFilter(const char* expression)
+{
+    return setCaptureFilter(cap_, expression);
+}
+
+bool PcapSource::captureStats(CaptureStats* stats)
+{
+    struct pcap_stat ps;
+    if (!live_ || pcap_stats(cap_, &ps) < 0)
+        return false;
+    stats->received = ps.ps_recv;
+    stats->dropped = ps.ps_drop;
+    return true;
+}
+
+std::unique_ptr<PacketSource> openPacketSource(
+        const char* name,
+        const PacketRingOptions& options)
+{
+    if (if_nametoindex(name) != 0) {
+        std::unique_ptr<PacketRing> ring(new PacketRing(name, options));
+        if (ring->valid())
+            return std::unique_ptr<PacketSource>(ring.release());
+        printf("%s, fall back to libpcap\n", ring->error().c_str());
+    }
+
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t* cap = pcap_open_live(name, static_cast<int>(options.snaplen),
+                                 options.promiscuous, 0, errbuf);
+    if (cap != nullptr) {
+        if (pcap_datalink(cap) == PCAP_ERROR_NOT_ACTIVATED) {
+            printf("%s\n", pcap_geterr(cap));
+            pcap_close(cap);
+            return nullptr;
+        }
+        return std::unique_ptr<PacketSource>(new PcapSource(cap, true));
+    }
+    printf("%s\n", errbuf);
+
+    std::unique_ptr<PcapFile> file(new PcapFile(name));
+    if (!file->valid()) {
+        printf("%s\n", file->error().c_str());
+        return nullptr;
+    }
+    return std::unique_ptr<PacketSource>(file.release());
+}
+
+}
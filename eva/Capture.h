@@ -0,0 +1,60 @@
+//
+// Created by frank on 18-2-3.
+//
+
+#ifndef EVA_CAPTURE_H
+#define EVA_CAPTURE_H
+
+#include <memory>
+
+#include <pcap.h>
+
+#include <eva/util.h>
+#include <eva/Unit.h>
+#include <eva/PacketSource.h>
+#include <eva/PacketRing.h>
+
+namespace eva
+{
+
+// parse a dotted decimal ipv4 address into network byte order,
+// the same byte order as Unit::srcIP and Unit::dstIP
+bool parseIPv4(const char* ip, uint32_t* addr);
+
+// "verify", "sample" or "trust"
+bool parseChecksumMode(const char* mode, ChecksumMode* checksumMode);
+
+// compile |expression| and install it on |cap|,
+// so that unrelated packets never reach user space
+bool setCaptureFilter(pcap_t* cap, const char* expression);
+
+// a libpcap handle, live or offline. libpcap reuses its buffer for
+// the next frame, so each read() returns at most one record
+class PcapSource: public PacketSource
+{
+public:
+    PcapSource(pcap_t* cap, bool live);
+    ~PcapSource() override;
+
+    int linkType() const override { return linkType_; }
+    bool isLive() const override { return live_; }
+    size_t read(PacketRecord* records, size_t n) override;
+    bool setFilter(const char* expression) override;
+    bool captureStats(CaptureStats* stats) override;
+
+private:
+    pcap_t* cap_;
+    bool live_;
+    int linkType_;
+};
+
+// capture on interface |name| with a TPACKET_V3 ring (libpcap if the ring
+// can not be set up), or read |name| as a pcap/pcapng file if it is not an
+// interface. print the reason and return null on failure
+std::unique_ptr<PacketSource> openPacketSource(
+        const char* name,
+        const PacketRingOptions& options = PacketRingOptions());
+
+}
+
+#endif //EVA_CAPTURE_H
@@ -0,0 +1,145 @@
+//
+// Created by frank on 18-2-11.
+//
+
+#ifndef EVA_DUPLEXFLOW_H
+#define EVA_DUPLEXFLOW_H
+
+#include <type_traits>
+
+#include <eva/Unit.h>
+
+namespace eva
+{
+
+// both directions of a connection under one flow table entry. side 0 is
+// the half whose sender is the low endpoint of the FlowKey. a unit is a
+// data unit of the half its source sends and an ack unit of the other
+// half, so one lookup feeds both. each half starts and ends as a one way
+// flow does: with sender data or a SYN from either side, and with the
+// sender's FIN or RST or the receiver's RST. an ended half reports on
+// destruction and may start again, e.g. on a reused tuple. the halves
+// are constructed in place, the entry holds no allocation of its own
+template <typename Half>
+class DuplexFlow: noncopyable
+{
+public:
+    DuplexFlow()
+            : startedCount_(0),
+              endedCount_(0)
+    {
+        open_[0] = open_[1] = false;
+    }
+
+    ~DuplexFlow()
+    {
+        for (int side = 0; side < 2; side++)
+            if (open_[side])
+                storage(side)->~Half();
+    }
+
+    static int senderSide(const Unit& u)
+    {
+        bool srcIsLow = u.srcIP < u.dstIP ||
+                        (u.srcIP == u.dstIP && u.srcPort <= u.dstPort);
+        return srcIsLow ? 0 : 1;
+    }
+
+    // |unit| would start its data half or its ack half
+    static bool startsData(const Unit& u)
+    {
+        return !u.isFIN() && !u.isRST() && (u.isSYN() || u.dataLength > 0);
+    }
+    static bool startsAck(const Unit& u) { return u.isSYN(); }
+
+    // feed |unit| to the halves the caller analyzes. a half it starts is
+    // constructed from the unit and |args|
+    template <typename... Args>
+    void onUnit(Unit* unit, bool asData, bool asAck, const Args&... args)
+    {
+        int side = senderSide(*unit);
+        if (asData)
+            onDataUnit(unit, side, args...);
+        if (asAck)
+            onAckUnit(unit, 1 - side, args...);
+    }
+
+    // nullptr if the half is not open
+    Half* half(int side) { return open_[side] ? storage(side) : nullptr; }
+    const Half* half(int side) const
+    { return open_[side] ? storage(side) : nullptr; }
+
+    bool empty() const { return !open_[0] && !open_[1]; }
+
+    // halves started and ended so far
+    uint32_t startedCount() const { return startedCount_; }
+    uint32_t endedCount() const { return endedCount_; }
+
+private:
+    Half* storage(int side)
+    { return reinterpret_cast<Half*>(&storage_[side]); }
+    const Half* storage(int side) const
+    { return reinterpret_cast<const Half*>(&storage_[side]); }
+
+    template <typename U, typename... Args>
+    Half* start(int side, const U& unit, const Args&... args)
+    {
+        Half* half = new (storage(side)) Half(unit, args...);
+        open_[side] = true;
+        startedCount_++;
+        return half;
+    }
+
+    void end(int side)
+    {
+        storage(side)->~Half();
+        open_[side] = false;
+        endedCount_++;
+    }
+
+    template <typename... Args>
+    void onDataUnit(Unit* unit, int side, const Args&... args)
+    {
+        DataUnit dataUnit(unit);
+
+        if (!open_[side]) {
+            // the tail of a half we never saw
+            if (startsData(*unit))
+                start(side, dataUnit, args...)->onDataUnit(dataUnit);
+        }
+        else if (unit->dataLength > 0 || unit->isSYN()) {
+            storage(side)->onDataUnit(dataUnit);
+        }
+        else if (unit->isFIN() || unit->isRST()) {
+            end(side);
+        }
+    }
+
+    template <typename... Args>
+    void onAckUnit(Unit* unit, int side, const Args&... args)
+    {
+        AckUnit ackUnit(unit);
+
+        if (!open_[side]) {
+            if (startsAck(*unit))
+                start(side, ackUnit, args...)->onAckUnit(ackUnit);
+        }
+        else if (!unit->isRST()) {
+            // unit.isFIN() should input, since sender can still send data
+            storage(side)->onAckUnit(ackUnit);
+        }
+        else {
+            end(side);
+        }
+    }
+
+    typename std::aligned_storage<sizeof(Half),
+                                  alignof(Half)>::type storage_[2];
+    bool open_[2];
+    uint32_t startedCount_;
+    uint32_t endedCount_;
+};
+
+}
+
+#endif //EVA_DUPLEXFLOW_H
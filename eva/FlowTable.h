@@ -0,0 +1,224 @@
+//
+// Created by frank on 18-2-1.
+//
+
+#ifndef EVA_FLOWTABLE_H
+#define EVA_FLOWTABLE_H
+
+#include <eva/Unit.h>
+#include <eva/ObjectPool.h>
+
+namespace eva
+{
+
+// ipv4 tcp 5-tuple, protocol is always tcp so it is not stored.
+// endpoints are ordered so that both directions map to the same key
+struct FlowKey
+{
+    uint32_t lowIP;
+    uint32_t highIP;
+    uint16_t lowPort;
+    uint16_t highPort;
+};
+
+static_assert(sizeof(FlowKey) == 12, "FlowKey should be 12 bytes");
+
+inline FlowKey makeFlowKey(uint32_t srcIP, uint32_t dstIP,
+                           uint16_t srcPort, uint16_t dstPort)
+{
+    bool srcIsLow = srcIP < dstIP || (srcIP == dstIP && srcPort <= dstPort);
+    return srcIsLow ?
+           FlowKey{srcIP, dstIP, srcPort, dstPort} :
+           FlowKey{dstIP, srcIP, dstPort, srcPort};
+}
+
+inline FlowKey makeFlowKey(const Unit& u)
+{
+    return makeFlowKey(u.srcIP, u.dstIP, u.srcPort, u.dstPort);
+}
+
+inline bool operator==(const FlowKey& lhs, const FlowKey& rhs)
+{
+    return lhs.lowIP == rhs.lowIP &&
+           lhs.highIP == rhs.highIP &&
+           lhs.lowPort == rhs.lowPort &&
+           lhs.highPort == rhs.highPort;
+}
+
+inline uint64_t hashFlowKey(const FlowKey& key)
+{
+    // murmur3 finalizer over the two key words
+    uint64_t ips = static_cast<uint64_t>(key.lowIP) << 32 | key.highIP;
+    uint64_t ports = static_cast<uint64_t>(key.lowPort) << 16 | key.highPort;
+    uint64_t h = ips ^ (ports * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// open addressing hash table with linear probing and backward shift deletion.
+// values live in an ObjectPool, so a value pointer stays valid across rehash
+// until the value is erased.
+//
+//   auto slot = table.lookup(key);     // the only probe
+//   if (!slot->occupied())
+//       table.emplace(slot, key, args...);
+template <typename T>
+class FlowTable: noncopyable
+{
+public:
+    struct Slot
+    {
+        FlowKey  key;
+        uint32_t hash;
+        T*       value;
+
+        bool occupied() const { return value != nullptr; }
+    };
+
+    explicit FlowTable(size_t initialCapacity = 1024):
+            slots_(roundUpPowerOf2(initialCapacity)),
+            mask_(slots_.size() - 1),
+            size_(0)
+    {}
+
+    ~FlowTable()
+    {
+        clear();
+    }
+
+    // return the slot holding |key|, or the empty slot where |key| should be
+    // inserted. the slot is valid until the next emplace() or erase()
+    Slot* lookup(const FlowKey& key)
+    {
+        auto hash = static_cast<uint32_t>(hashFlowKey(key));
+        size_t i = hash & mask_;
+        while (true) {
+            Slot* slot = &slots_[i];
+            if (!slot->occupied())
+                return slot;
+            if (slot->hash == hash && slot->key == key)
+                return slot;
+            i = (i + 1) & mask_;
+        }
+    }
+
+    T* find(const FlowKey& key)
+    {
+        return lookup(key)->value;
+    }
+
+    // construct a value in an empty slot returned by lookup(key)
+    template <typename... Args>
+    T* emplace(Slot* slot, const FlowKey& key, Args&&... args)
+    {
+        assert(!slot->occupied());
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            rehash(slots_.size() * 2);
+            slot = lookup(key);
+        }
+        slot->key = key;
+        slot->hash = static_cast<uint32_t>(hashFlowKey(key));
+        slot->value = pool_.construct(std::forward<Args>(args)...);
+        size_++;
+        return slot->value;
+    }
+
+    void erase(Slot* slot)
+    {
+        assert(slot->occupied());
+        pool_.destroy(slot->value);
+        size_--;
+
+        // backward shift, so there is no tombstone and lookup
+        // never probes longer than the cluster it belongs to
+        size_t hole = static_cast<size_t>(slot - slots_.data());
+        size_t i = hole;
+        while (true) {
+            i = (i + 1) & mask_;
+            Slot& s = slots_[i];
+            if (!s.occupied())
+                break;
+            size_t home = s.hash & mask_;
+            // move s into the hole if its home is not in (hole, i]
+            if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+                slots_[hole] = s;
+                hole = i;
+            }
+        }
+        slots_[hole].value = nullptr;
+    }
+
+    void erase(const FlowKey& key)
+    {
+        Slot* slot = lookup(key);
+        if (slot->occupied())
+            erase(slot);
+    }
+
+    template <typename Func>
+    void forEach(Func&& func)
+    {
+        for (auto& slot: slots_) {
+            if (slot.occupied())
+                func(slot.key, slot.value);
+        }
+    }
+
+    void clear()
+    {
+        for (auto& slot: slots_) {
+            if (slot.occupied()) {
+                pool_.destroy(slot.value);
+                slot.value = nullptr;
+            }
+        }
+        size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t bucketCount() const { return slots_.size(); }
+
+    size_t memoryBytes() const
+    {
+        return slots_.size() * sizeof(Slot) + pool_.memoryBytes();
+    }
+
+private:
+    static size_t roundUpPowerOf2(size_t n)
+    {
+        size_t ret = 16;
+        while (ret < n)
+            ret <<= 1;
+        return ret;
+    }
+
+    void rehash(size_t newCapacity)
+    {
+        std::vector<Slot> old(newCapacity);
+        old.swap(slots_);
+        mask_ = slots_.size() - 1;
+
+        for (auto& s: old) {
+            if (!s.occupied())
+                continue;
+            size_t i = s.hash & mask_;
+            while (slots_[i].occupied())
+                i = (i + 1) & mask_;
+            slots_[i] = s;
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    size_t size_;
+    ObjectPool<T> pool_;
+};
+
+}
+
+#endif //EVA_FLOWTABLE_H
@@ -0,0 +1,204 @@
+//
+// Created by frank on 18-2-8.
+//
+
+#include <eva/FlowTracker.h>
+#include <eva/Profile.h>
+
+using namespace eva;
+
+namespace
+{
+
+// flows expire up to one tick late
+const int64_t kTimerTick = Timestamp::kMicroSecondsPerSecond;
+
+}
+
+bool eva::parseIdleTimeout(const char* seconds, int64_t* idle)
+{
+    const int64_t kMaxSeconds = INT64_MAX / Timestamp::kMicroSecondsPerSecond;
+    // out of range saturates, and is rejected as too large or small
+    char* end;
+    long long n = strtoll(seconds, &end, 10);
+    if (end == seconds || *end != '\0' || n <= 0 || n > kMaxSeconds) {
+        LOG_ERROR << "bad idle timeout " << seconds
+                  << ", should be 1 to " << kMaxSeconds << " seconds";
+        return false;
+    }
+    *idle = n * Timestamp::kMicroSecondsPerSecond;
+    return true;
+}
+
+bool eva::parseDuplexMode(const char* mode, bool* duplex)
+{
+    if (strcmp(mode, "simplex") == 0)
+        *duplex = false;
+    else if (strcmp(mode, "duplex") == 0)
+        *duplex = true;
+    else {
+        LOG_ERROR << "bad direction mode " << mode
+                  << ", should be simplex or duplex";
+        return false;
+    }
+    return true;
+}
+
+bool eva::parseScreenMode(const char* mode, bool* screen)
+{
+    if (strcmp(mode, "full") == 0)
+        *screen = false;
+    else if (strcmp(mode, "screen") == 0)
+        *screen = true;
+    else {
+        LOG_ERROR << "bad analysis mode " << mode
+                  << ", should be full or screen";
+        return false;
+    }
+    return true;
+}
+
+FlowTracker::FlowTracker(uint32_t srcIP,
+                         uint32_t dstIP,
+                         const FlowTimeouts& timeouts,
+                         bool duplex,
+                         bool screen)
+        : srcIP_(srcIP),
+          dstIP_(dstIP),
+          timeouts_(timeouts),
+          duplex_(duplex),
+          screen_(screen),
+          timers_(kTimerTick),
+          analyzed_(false),
+          flowCount_(0),
+          expiredCount_(0),
+          promotedCount_(0),
+          nextId_(0)
+{
+}
+
+FlowTracker::~FlowTracker()
+{
+    clear();
+}
+
+void FlowTracker::advance(Timestamp now)
+{
+    timers_.advance(now.microSecondsSinceEpoch(),
+                    [this, now](const FlowTimer& timer) {
+                        expire(timer, now);
+                    });
+}
+
+void FlowTracker::onUnit(Unit* unit)
+{
+    // before the lookup, erase() moves slots
+    advance(unit->when);
+
+    bool asData = analyzes(unit->srcIP, unit->dstIP);
+    bool asAck = analyzes(unit->dstIP, unit->srcIP);
+    if (!asData && !asAck)
+        return;
+
+    StageTimer lookupTimer(kStageLookup);
+    FlowKey key = makeFlowKey(*unit);
+    auto slot = flowTable_.lookup(key);
+    Flow* flow = slot->value;
+    if (flow == nullptr) {
+        if (!(asData && Duplex::startsData(*unit)) &&
+            !(asAck && Duplex::startsAck(*unit)))
+            return;
+        flow = flowTable_.emplace(slot, key, ++nextId_, unit->when);
+        slot = nullptr; // emplace() may rehash
+        arm(key, *flow);
+    }
+    lookupTimer.stop();
+    flow->lastSeen = unit->when;
+    if (asData)
+        flow->seenData |= unit->dataLength > 0;
+
+    auto& duplex = flow->duplex;
+    uint32_t started = duplex.startedCount();
+    uint32_t ended = duplex.endedCount();
+    int promoted = screen_ ? promotedSides(duplex) : 0;
+    duplex.onUnit(unit, asData, asAck, screen_, &aggregate_, &analyzerPool_);
+    flowCount_ += duplex.startedCount() - started;
+    // a promoted half that ended is no longer open, but stays counted
+    if (screen_)
+        promotedCount_ += static_cast<uint64_t>(
+                __builtin_popcount(promotedSides(duplex) & ~promoted));
+
+    if (duplex.endedCount() != ended) {
+        analyzed_ = true;
+        if (duplex.empty()) {
+            if (slot == nullptr)
+                slot = flowTable_.lookup(key);
+            flowTable_.erase(slot);
+        }
+    }
+}
+
+int FlowTracker::promotedSides(const Duplex& duplex)
+{
+    int sides = 0;
+    for (int side = 0; side < 2; side++) {
+        if (duplex.half(side) != nullptr && duplex.half(side)->promoted())
+            sides |= 1 << side;
+    }
+    return sides;
+}
+
+bool FlowTracker::analyzes(uint32_t sender, uint32_t receiver) const
+{
+    if (sender == srcIP_ && (dstIP_ == 0 || receiver == dstIP_))
+        return true;
+    // the other direction of a connection we analyze
+    return duplex_ && receiver == srcIP_ && (dstIP_ == 0 || sender == dstIP_);
+}
+
+int64_t FlowTracker::deadline(const Flow& flow) const
+{
+    int64_t timeout = flow.seenData || timeouts_.halfOpen == 0 ?
+                      timeouts_.idle : timeouts_.halfOpen;
+    return flow.lastSeen.microSecondsSinceEpoch() + timeout;
+}
+
+void FlowTracker::arm(const FlowKey& key, const Flow& flow)
+{
+    if (timeouts_.idle > 0)
+        timers_.schedule(deadline(flow), FlowTimer{key, flow.id});
+}
+
+void FlowTracker::expire(const FlowTimer& timer, Timestamp now)
+{
+    Slot* slot = flowTable_.lookup(timer.key);
+    // the flow has ended, maybe a new one took its tuple
+    if (!slot->occupied() || slot->value->id != timer.id)
+        return;
+
+    int64_t when = deadline(*slot->value);
+    if (when > now.microSecondsSinceEpoch()) {
+        timers_.schedule(when, timer);
+        return;
+    }
+
+    // the analyzers report as they do on FIN
+    auto& duplex = slot->value->duplex;
+    const ScreenedFlow* half = duplex.half(0) ? duplex.half(0) :
+                                                duplex.half(1);
+    LOG_DEBUG << "flow " << half->srcAddress().toIpPort()
+              << "->" << half->dstAddress().toIpPort()
+              << " expired";
+    flowTable_.erase(slot);
+    analyzed_ = true;
+    expiredCount_++;
+}
+
+void FlowTracker::clear()
+{
+    if (!flowTable_.empty()) {
+        flowTable_.clear();
+        analyzed_ = true;
+    }
+    timers_.clear();
+}
@@ -0,0 +1,133 @@
+//
+// Created by frank on 18-2-8.
+//
+
+#ifndef EVA_FLOWTRACKER_H
+#define EVA_FLOWTRACKER_H
+
+#include <eva/ScreenedFlow.h>
+#include <eva/DuplexFlow.h>
+#include <eva/FlowTable.h>
+#include <eva/TimerWheel.h>
+
+namespace eva
+{
+
+// how long a flow may stay silent, in microseconds of packet time,
+// before it is ended as if it had sent a FIN. idle 0 never ends a flow
+struct FlowTimeouts
+{
+    // flows that sent data
+    int64_t idle = 120 * Timestamp::kMicroSecondsPerSecond;
+    // flows that got no further than the handshake
+    int64_t halfOpen = 20 * Timestamp::kMicroSecondsPerSecond;
+};
+
+// a positive number of seconds, stored in |idle| as microseconds
+bool parseIdleTimeout(const char* seconds, int64_t* idle);
+
+// "simplex" analyzes the data of the tracked sender only, "duplex" the
+// data its peers send back as well
+bool parseDuplexMode(const char* mode, bool* duplex);
+
+// "full" analyzes every flow in full, "screen" screens them first
+bool parseScreenMode(const char* mode, bool* screen);
+
+// split the units of one sender into data and ack units and feed them to
+// the analyzer of their flow. a flow starts with a SYN from either side or
+// with sender data, and ends with the sender's FIN or RST or the
+// receiver's RST, or when it has been silent for longer than its
+// timeout. with |duplex| the peers of the sender are analyzed as senders
+// too, and both directions of a connection share one table entry. with
+// |screen| flows are screened and only the anomalous ones are diagnosed
+// in full, see ScreenedFlow. not thread safe, each pipeline worker owns one
+class FlowTracker: noncopyable
+{
+public:
+    // |dstIP| 0 tracks flows from |srcIP| to any receiver
+    FlowTracker(uint32_t srcIP,
+                uint32_t dstIP,
+                const FlowTimeouts& timeouts = FlowTimeouts(),
+                bool duplex = false,
+                bool screen = false);
+    ~FlowTracker();
+
+    void onUnit(Unit* unit);
+
+    // expire the flows silent past their timeout at packet time |now|.
+    // onUnit() does it for every unit, a pipeline worker also does it for
+    // the capture's packet time, so the flows of a quiet shard expire too
+    void advance(Timestamp now);
+
+    // end the flows still open, their analyzers report on destruction
+    void clear();
+
+    // at least one flow has ended
+    bool analyzed() const { return analyzed_; }
+    // in duplex mode each direction of a connection is a flow
+    uint64_t flowCount() const { return flowCount_; }
+    uint64_t expiredCount() const { return expiredCount_; }
+    // flows the screener handed to a full analyzer
+    uint64_t promotedCount() const { return promotedCount_; }
+    // connections in the flow table
+    size_t activeCount() const { return flowTable_.size(); }
+
+    // the round trips of all flows analyzed so far, ended or not
+    const ResultAggregate& aggregate() const { return aggregate_; }
+
+private:
+    typedef DuplexFlow<ScreenedFlow> Duplex;
+
+    struct Flow
+    {
+        Flow(uint64_t id_, Timestamp when)
+                : id(id_),
+                  lastSeen(when),
+                  seenData(false)
+        {}
+
+        Duplex    duplex;   // one open half unless the tracker is duplex
+        uint64_t  id;       // tells a flow from a later one on the same tuple
+        Timestamp lastSeen;
+        bool      seenData;
+    };
+
+    // armed once per flow. when it fires, a flow that was active since is
+    // armed again for its new deadline, so a unit only updates lastSeen
+    struct FlowTimer
+    {
+        FlowKey  key;
+        uint64_t id;
+    };
+
+    typedef FlowTable<Flow>::Slot Slot;
+
+    // the tracker analyzes data sent from |sender| to |receiver|
+    bool analyzes(uint32_t sender, uint32_t receiver) const;
+    // a bit per side whose half is open and promoted
+    static int promotedSides(const Duplex& duplex);
+
+    int64_t deadline(const Flow& flow) const;
+    void arm(const FlowKey& key, const Flow& flow);
+    void expire(const FlowTimer& timer, Timestamp now);
+
+    const uint32_t srcIP_;
+    const uint32_t dstIP_;
+    const FlowTimeouts timeouts_;
+    const bool duplex_;
+    const bool screen_;
+    // outlive the analyzers of the flow table
+    ResultAggregate aggregate_;
+    AnalyzerPool analyzerPool_;
+    FlowTable<Flow> flowTable_;
+    TimerWheel<FlowTimer> timers_;
+    bool analyzed_;
+    uint64_t flowCount_;
+    uint64_t expiredCount_;
+    uint64_t promotedCount_;
+    uint64_t nextId_;
+};
+
+}
+
+#endif //EVA_FLOWTRACKER_H
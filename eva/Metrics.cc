@@ -0,0 +1,315 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <string.h>
+
+#include <algorithm>
+#include <future>
+
+#include <eva/Metrics.h>
+#include <eva/Pipeline.h>
+#include <eva/Profile.h>
+
+using namespace eva;
+
+namespace
+{
+
+// how often the capture thread reads the kernel counters, in seconds
+const double kCaptureStatsInterval = 1.0;
+
+// a request without its headers after this many bytes is dropped
+const size_t kMaxRequestSize = 8192;
+
+uint64_t load(const std::atomic<uint64_t>& counter)
+{
+    return counter.load(std::memory_order_relaxed);
+}
+
+void store(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(value, std::memory_order_relaxed);
+}
+
+void appendHeader(const char* name, const char* type, const char* help,
+                  std::string* out)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n",
+             name, help, name, type);
+    out->append(buf);
+}
+
+void appendValue(const char* name, uint64_t value, std::string* out)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s %lu\n", name, value);
+    out->append(buf);
+}
+
+void appendValue(const char* name, const char* label, const char* labelValue,
+                 uint64_t value, std::string* out)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s{%s=\"%s\"} %lu\n",
+             name, label, labelValue, value);
+    out->append(buf);
+}
+
+// the stages of a profiling build as a Prometheus summary in seconds
+void appendProfile(std::string* out)
+{
+    std::vector<StageSummary> stages;
+    double nsPerCycle;
+    sampleProfile(&stages, &nsPerCycle);
+    if (stages.empty())
+        return;
+
+    const double kQuantiles[] = {0.5, 0.9, 0.99};
+    appendHeader("eva_stage_seconds", "summary",
+                 "Time of a sampled packet path stage.", out);
+    char buf[256];
+    for (size_t i = 0; i < stages.size(); i++) {
+        auto& s = stages[i];
+        auto name = profileStageName(static_cast<ProfileStage>(i));
+        for (double q: kQuantiles) {
+            double seconds = static_cast<double>(s.quantile(q)) *
+                             nsPerCycle / 1e9;
+            snprintf(buf, sizeof(buf),
+                     "eva_stage_seconds{stage=\"%s\",quantile=\"%g\"} %g\n",
+                     name, q, seconds);
+            out->append(buf);
+        }
+        snprintf(buf, sizeof(buf),
+                 "eva_stage_seconds_sum{stage=\"%s\"} %g\n", name,
+                 static_cast<double>(s.sum) * nsPerCycle / 1e9);
+        out->append(buf);
+        appendValue("eva_stage_seconds_count", "stage", name, s.count, out);
+    }
+}
+
+void sendResponse(const TcpConnectionPtr& conn, const char* status,
+                  const std::string& body)
+{
+    char header[256];
+    snprintf(header, sizeof(header),
+             "HTTP/1.1 %s\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %lu\r\n"
+             "Connection: close\r\n"
+             "\r\n", status, body.size());
+    conn->send(header + body);
+    conn->shutdown();
+}
+
+}
+
+bool eva::parseMetricsPort(const char* port, uint16_t* metricsPort)
+{
+    char* end;
+    long n = strtol(port, &end, 10);
+    if (end == port || *end != '\0' || n < 1 || n > UINT16_MAX) {
+        LOG_ERROR << "bad metrics port " << port
+                  << ", should be 1 to " << UINT16_MAX;
+        return false;
+    }
+    *metricsPort = static_cast<uint16_t>(n);
+    return true;
+}
+
+CaptureMetrics::CaptureMetrics()
+        : packets_(0),
+          received_(0),
+          dropped_(0),
+          hasCaptureStats_(false)
+{
+    for (auto& drop: drops_)
+        store(drop, 0);
+}
+
+void CaptureMetrics::publish(const UnpackStats& stats, PacketSource* source)
+{
+    store(packets_, stats.packets);
+    for (int i = 0; i < kNUnpackErrors; i++)
+        store(drops_[i], stats.drops[i]);
+
+    Timestamp now = Timestamp::now();
+    if (timeDifference(now, lastCaptureStats_) < kCaptureStatsInterval)
+        return;
+    lastCaptureStats_ = now;
+    CaptureStats captureStats;
+    if (source->captureStats(&captureStats)) {
+        store(received_, captureStats.received);
+        store(dropped_, captureStats.dropped);
+        hasCaptureStats_.store(true, std::memory_order_relaxed);
+    }
+}
+
+void CaptureMetrics::sample(UnpackStats* stats, CaptureStats* captureStats,
+                            bool* hasCaptureStats) const
+{
+    stats->packets = load(packets_);
+    for (int i = 0; i < kNUnpackErrors; i++)
+        stats->drops[i] = load(drops_[i]);
+    captureStats->received = load(received_);
+    captureStats->dropped = load(dropped_);
+    *hasCaptureStats = hasCaptureStats_.load(std::memory_order_relaxed);
+}
+
+FlowMetrics::FlowMetrics()
+        : units_(0),
+          flows_(0),
+          expired_(0),
+          promoted_(0),
+          active_(0)
+{
+    for (auto& roundtrip: roundtrips_)
+        store(roundtrip, 0);
+}
+
+void FlowMetrics::publish(const FlowTracker& tracker, size_t units)
+{
+    // only this thread writes, no need for an atomic add
+    store(units_, load(units_) + units);
+    store(flows_, tracker.flowCount());
+    store(expired_, tracker.expiredCount());
+    store(promoted_, tracker.promotedCount());
+    store(active_, tracker.activeCount());
+    auto& total = tracker.aggregate().total();
+    for (int i = 0; i < kNOutput; i++)
+        store(roundtrips_[i], static_cast<uint64_t>(total.flights[i]));
+}
+
+void FlowMetrics::addTo(FlowSample* sample) const
+{
+    sample->units += load(units_);
+    sample->flows += load(flows_);
+    sample->expired += load(expired_);
+    sample->promoted += load(promoted_);
+    sample->active += load(active_);
+    for (int i = 0; i < kNOutput; i++)
+        sample->roundtrips[i] += load(roundtrips_[i]);
+}
+
+MetricsServer::MetricsServer(uint16_t port,
+                             const Pipeline& pipeline,
+                             const CaptureMetrics& capture)
+        : pipeline_(pipeline),
+          capture_(capture),
+          loop_(loopThread_.startLoop()),
+          server_(new TcpServer(loop_, InetAddress(port, true), "metrics"))
+{
+    server_->setMessageCallback(std::bind(
+            &MetricsServer::onMessage, this, _1, _2, _3));
+}
+
+MetricsServer::~MetricsServer()
+{
+    // a TcpServer is destroyed in its loop thread, before the loop quits
+    std::promise<void> destroyed;
+    loop_->runInLoop([this, &destroyed]() {
+        server_.reset();
+        destroyed.set_value();
+    });
+    destroyed.get_future().wait();
+}
+
+void MetricsServer::start()
+{
+    server_->start();
+}
+
+void MetricsServer::onMessage(const TcpConnectionPtr& conn,
+                              Buffer* buf,
+                              Timestamp)
+{
+    const char kEnd[] = "\r\n\r\n";
+    const char* end = std::search(buf->peek(),
+                                  buf->peek() + buf->readableBytes(),
+                                  kEnd, kEnd + 4);
+    if (end == buf->peek() + buf->readableBytes()) {
+        if (buf->readableBytes() > kMaxRequestSize) {
+            buf->retrieveAll();
+            conn->shutdown();
+        }
+        return;
+    }
+
+    // one request per connection, the rest is ignored
+    std::string request(buf->peek(), end);
+    buf->retrieveAll();
+    const char kGet[] = "GET /metrics";
+    if (request.compare(0, strlen(kGet), kGet) != 0 ||
+        (request.size() > strlen(kGet) &&
+         request[strlen(kGet)] != ' ' && request[strlen(kGet)] != '?')) {
+        sendResponse(conn, "404 Not Found", "not found\n");
+        return;
+    }
+    sendResponse(conn, "200 OK", render());
+}
+
+std::string MetricsServer::render() const
+{
+    UnpackStats unpack;
+    CaptureStats kernel;
+    bool hasKernel;
+    capture_.sample(&unpack, &kernel, &hasKernel);
+
+    FlowSample flows;
+    std::vector<size_t> queueDepths;
+    pipeline_.sample(&flows, &queueDepths);
+
+    std::string out;
+    appendHeader("eva_packets_total", "counter",
+                 "Frames read from the capture.", &out);
+    appendValue("eva_packets_total", unpack.packets, &out);
+    appendHeader("eva_parse_drops_total", "counter",
+                 "Frames that did not parse, by reason.", &out);
+    for (int i = kUnpackOk + 1; i < kNUnpackErrors; i++)
+        appendValue("eva_parse_drops_total", "reason",
+                    unpackErrorName(static_cast<UnpackError>(i)),
+                    unpack.drops[i], &out);
+    if (hasKernel) {
+        appendHeader("eva_kernel_received_total", "counter",
+                     "Frames received by the kernel capture.", &out);
+        appendValue("eva_kernel_received_total", kernel.received, &out);
+        appendHeader("eva_kernel_dropped_total", "counter",
+                     "Frames the kernel dropped before the capture.", &out);
+        appendValue("eva_kernel_dropped_total", kernel.dropped, &out);
+    }
+
+    appendHeader("eva_units_analyzed_total", "counter",
+                 "Units fed to the flow trackers.", &out);
+    appendValue("eva_units_analyzed_total", flows.units, &out);
+    appendHeader("eva_flows_created_total", "counter",
+                 "Flows started, each direction in duplex mode.", &out);
+    appendValue("eva_flows_created_total", flows.flows, &out);
+    appendHeader("eva_flows_expired_total", "counter",
+                 "Flows ended by the idle timeouts.", &out);
+    appendValue("eva_flows_expired_total", flows.expired, &out);
+    appendHeader("eva_flows_promoted_total", "counter",
+                 "Screened flows handed to a full analyzer.", &out);
+    appendValue("eva_flows_promoted_total", flows.promoted, &out);
+    appendHeader("eva_flows_active", "gauge",
+                 "Connections in the flow tables.", &out);
+    appendValue("eva_flows_active", flows.active, &out);
+    appendHeader("eva_roundtrips_total", "counter",
+                 "Round trips analyzed, by what limited them.", &out);
+    for (int i = 0; i < kNOutput; i++)
+        appendValue("eva_roundtrips_total", "limit",
+                    roundtripLimitName(static_cast<RoundtripLimit>(i)),
+                    flows.roundtrips[i], &out);
+
+    if (!queueDepths.empty()) {
+        appendHeader("eva_queue_depth", "gauge",
+                     "Units waiting in the queue of a worker.", &out);
+        for (size_t i = 0; i < queueDepths.size(); i++)
+            appendValue("eva_queue_depth", "worker",
+                        std::to_string(i).c_str(), queueDepths[i], &out);
+    }
+
+    if (kProfileEnabled)
+        appendProfile(&out);
+    return out;
+}
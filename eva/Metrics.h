@@ -0,0 +1,110 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#ifndef EVA_METRICS_H
+#define EVA_METRICS_H
+
+#include <atomic>
+#include <memory>
+
+#include <eva/util.h>
+#include <eva/PacketSource.h>
+#include <eva/ResultSink.h>
+
+namespace eva
+{
+
+class FlowTracker;
+class Pipeline;
+
+// the counters below are each written by one thread of the packet path
+// with relaxed stores, once per batch, and read with relaxed loads by the
+// metrics server. a scrape sees values at most a batch old, never a lock
+
+// what the capture thread publishes
+class CaptureMetrics: noncopyable
+{
+public:
+    CaptureMetrics();
+
+    // capture thread, after each batch. kernel counters of |source| are
+    // read about once a second, they cost a system call
+    void publish(const UnpackStats& stats, PacketSource* source);
+
+    // any thread
+    void sample(UnpackStats* stats, CaptureStats* captureStats,
+                bool* hasCaptureStats) const;
+
+private:
+    std::atomic<uint64_t> packets_;
+    std::atomic<uint64_t> drops_[kNUnpackErrors];
+    std::atomic<uint64_t> received_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<bool> hasCaptureStats_;
+    Timestamp lastCaptureStats_;
+};
+
+// the counters of the flow trackers, summed over the workers
+struct FlowSample
+{
+    uint64_t units = 0;
+    uint64_t flows = 0;
+    uint64_t expired = 0;
+    uint64_t promoted = 0;
+    uint64_t active = 0;
+    uint64_t roundtrips[kNOutput] = {};
+};
+
+// what the thread owning a FlowTracker publishes
+class FlowMetrics: noncopyable
+{
+public:
+    FlowMetrics();
+
+    // owning thread, after each batch of |units| units
+    void publish(const FlowTracker& tracker, size_t units);
+
+    // any thread
+    void addTo(FlowSample* sample) const;
+
+private:
+    std::atomic<uint64_t> units_;
+    std::atomic<uint64_t> flows_;
+    std::atomic<uint64_t> expired_;
+    std::atomic<uint64_t> promoted_;
+    std::atomic<uint64_t> active_;
+    std::atomic<uint64_t> roundtrips_[kNOutput];
+};
+
+// a tcp port from 1 to 65535
+bool parseMetricsPort(const char* port, uint16_t* metricsPort);
+
+// serve GET /metrics in the Prometheus text format on the loopback
+// interface. the server runs its own EventLoop thread, a scrape only reads
+// the counters above and the depths of the worker queues
+class MetricsServer: noncopyable
+{
+public:
+    MetricsServer(uint16_t port,
+                  const Pipeline& pipeline,
+                  const CaptureMetrics& capture);
+    // stop serving, before the pipeline goes away
+    ~MetricsServer();
+
+    void start();
+
+private:
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, Timestamp);
+    std::string render() const;
+
+    const Pipeline& pipeline_;
+    const CaptureMetrics& capture_;
+    EventLoopThread loopThread_;
+    EventLoop* loop_;
+    std::unique_ptr<TcpServer> server_;
+};
+
+}
+
+#endif //EVA_METRICS_H
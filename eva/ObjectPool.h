@@ -0,0 +1,84 @@
+//
+// Created by frank on 18-2-1.
+//
+
+#ifndef EVA_OBJECTPOOL_H
+#define EVA_OBJECTPOOL_H
+
+#include <memory>
+#include <vector>
+#include <type_traits>
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// fixed size object storage, allocated in chunks and recycled with a free list,
+// so flow churn does not hit the global allocator and objects never move
+template <typename T, size_t kObjectsPerChunk = 1024>
+class ObjectPool: noncopyable
+{
+public:
+    ObjectPool():
+            freeList_(nullptr),
+            used_(kObjectsPerChunk)
+    {}
+
+    ~ObjectPool() = default;
+
+    template <typename... Args>
+    T* construct(Args&&... args)
+    {
+        void* mem = allocate();
+        return new (mem) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* obj)
+    {
+        obj->~T();
+        deallocate(obj);
+    }
+
+    size_t capacity() const
+    { return chunks_.size() * kObjectsPerChunk; }
+
+    size_t memoryBytes() const
+    { return capacity() * sizeof(Storage); }
+
+private:
+    union Storage
+    {
+        Storage* next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type object;
+    };
+
+    void* allocate()
+    {
+        if (freeList_ != nullptr) {
+            Storage* s = freeList_;
+            freeList_ = s->next;
+            return s;
+        }
+        if (used_ == kObjectsPerChunk) {
+            chunks_.emplace_back(new Storage[kObjectsPerChunk]);
+            used_ = 0;
+        }
+        return &chunks_.back()[used_++];
+    }
+
+    void deallocate(void* mem)
+    {
+        auto s = static_cast<Storage*>(mem);
+        s->next = freeList_;
+        freeList_ = s;
+    }
+
+    std::vector<std::unique_ptr<Storage[]>> chunks_;
+    Storage* freeList_;
+    size_t used_;
+};
+
+}
+
+#endif //EVA_OBJECTPOOL_H
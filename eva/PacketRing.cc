@@ -0,0 +1,294 @@
+//
+// Created by frank on 18-2-7.
+//
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <eva/PacketRing.h>
+
+namespace eva
+{
+
+PacketRing::PacketRing(const char* interface, const PacketRingOptions& options)
+        : options_(options),
+          fd_(-1),
+          ifindex_(0),
+          ring_(nullptr),
+          ringSize_(0),
+          valid_(false),
+          started_(false),
+          hasFilter_(false),
+          block_(0),
+          blockHeld_(false),
+          framesLeft_(0),
+          nextFrame_(nullptr)
+{
+    // protocol 0 receives nothing until start() binds the socket,
+    // so a filter installed before the first read() sees every frame
+    fd_ = ::socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        setError("socket");
+        return;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+    if (ioctl(fd_, SIOCGIFINDEX, &ifr) < 0) {
+        setError(interface);
+        return;
+    }
+    ifindex_ = ifr.ifr_ifindex;
+
+    if (ioctl(fd_, SIOCGIFHWADDR, &ifr) < 0) {
+        setError(interface);
+        return;
+    }
+    if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER &&
+        ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK) {
+        error_ = std::string(interface) + ": not an ethernet interface";
+        return;
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0) {
+        setError("PACKET_VERSION");
+        return;
+    }
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = options_.blockSize;
+    req.tp_block_nr = options_.blockCount;
+    req.tp_frame_size = options_.frameSize;
+    req.tp_frame_nr = options_.blockSize / options_.frameSize *
+                      options_.blockCount;
+    req.tp_retire_blk_tov = options_.retireTimeoutMs;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        setError("PACKET_RX_RING");
+        return;
+    }
+
+    ringSize_ = size_t(options_.blockSize) * options_.blockCount;
+    void* addr = mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+        setError("mmap");
+        return;
+    }
+    ring_ = static_cast<unsigned char*>(addr);
+
+    if (options_.promiscuous) {
+        struct packet_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ifindex_;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(fd_, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                       &mreq, sizeof(mreq)) < 0) {
+            setError("PACKET_ADD_MEMBERSHIP");
+            return;
+        }
+    }
+    valid_ = true;
+}
+
+PacketRing::~PacketRing()
+{
+    if (ring_ != nullptr)
+        munmap(ring_, ringSize_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+bool PacketRing::setError(const char* what)
+{
+    error_ = std::string(what) + ": " + strerror(errno);
+    return false;
+}
+
+bool PacketRing::attachFilter(struct bpf_insn* insns, uint32_t count)
+{
+    // struct bpf_insn and struct sock_filter share the classic bpf layout,
+    // the value a program returns is the number of bytes to keep
+    void* any = insns;
+    struct sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(count);
+    fprog.filter = static_cast<struct sock_filter*>(any);
+
+    if (setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &fprog, sizeof(fprog)) < 0) {
+        LOG_SYSERR << "SO_ATTACH_FILTER";
+        return false;
+    }
+    hasFilter_ = true;
+    return true;
+}
+
+bool PacketRing::start()
+{
+    // no filter from the user, truncate to snaplen anyway
+    if (!hasFilter_ && options_.snaplen < kFullSnaplen) {
+        struct bpf_insn acceptAll;
+        acceptAll.code = BPF_RET | BPF_K;
+        acceptAll.jt = 0;
+        acceptAll.jf = 0;
+        acceptAll.k = options_.snaplen;
+        if (!attachFilter(&acceptAll, 1))
+            return false;
+    }
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex_;
+
+    void* any = &addr;
+    if (bind(fd_, static_cast<struct sockaddr*>(any), sizeof(addr)) < 0) {
+        setError("bind");
+        LOG_ERROR << error_;
+        return false;
+    }
+    started_ = true;
+    return true;
+}
+
+bool PacketRing::waitBlock()
+{
+    void* any = ring_ + size_t(block_) * options_.blockSize;
+    auto desc = static_cast<struct tpacket_block_desc*>(any);
+
+    while ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+            TP_STATUS_USER) == 0) {
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, options_.readTimeoutMs);
+        if (ret == 0)
+            return false;
+        if (ret < 0 && errno != EINTR) {
+            LOG_SYSERR << "poll";
+            return false;
+        }
+    }
+    return true;
+}
+
+void PacketRing::releaseBlock()
+{
+    void* any = ring_ + size_t(block_) * options_.blockSize;
+    auto desc = static_cast<struct tpacket_block_desc*>(any);
+
+    __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+    block_ = (block_ + 1) % options_.blockCount;
+    blockHeld_ = false;
+}
+
+size_t PacketRing::read(PacketRecord* records, size_t n)
+{
+    if (!valid_ || n == 0)
+        return 0;
+    if (!started_ && !start())
+        return 0;
+
+    // records of the last read() point into the held block
+    while (framesLeft_ == 0) {
+        if (blockHeld_)
+            releaseBlock();
+        if (!waitBlock())
+            return 0;
+
+        void* any = ring_ + size_t(block_) * options_.blockSize;
+        auto desc = static_cast<struct tpacket_block_desc*>(any);
+        blockHeld_ = true;
+        framesLeft_ = desc->hdr.bh1.num_pkts;
+        nextFrame_ = ring_ + size_t(block_) * options_.blockSize +
+                     desc->hdr.bh1.offset_to_first_pkt;
+    }
+
+    size_t i = 0;
+    for (; i < n && framesLeft_ > 0; i++) {
+        const void* any = nextFrame_;
+        auto hdr = static_cast<const struct tpacket3_hdr*>(any);
+
+        records[i].when = static_cast<int64_t>(hdr->tp_sec) *
+                          Timestamp::kMicroSecondsPerSecond +
+                          hdr->tp_nsec / 1000;
+        records[i].caplen = hdr->tp_snaplen;
+        records[i].len = hdr->tp_len;
+        records[i].data = nextFrame_ + hdr->tp_mac;
+
+        nextFrame_ += hdr->tp_next_offset;
+        framesLeft_--;
+    }
+    return i;
+}
+
+bool PacketRing::setFilter(const char* expression)
+{
+    if (!valid_)
+        return false;
+
+    // accepted frames are cut to snaplen
+    pcap_t* dead = pcap_open_dead(DLT_EN10MB, static_cast<int>(options_.snaplen));
+    if (dead == nullptr) {
+        LOG_ERROR << "pcap_open_dead failed";
+        return false;
+    }
+
+    struct bpf_program program;
+    if (pcap_compile(dead, &program, expression, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        LOG_ERROR << "pcap_compile \"" << expression << "\": " << pcap_geterr(dead);
+        pcap_close(dead);
+        return false;
+    }
+    pcap_close(dead);
+
+    bool ok = attachFilter(program.bf_insns, program.bf_len);
+    if (!ok)
+        LOG_ERROR << "can not attach \"" << expression << "\"";
+    pcap_freecode(&program);
+    return ok;
+}
+
+void PacketRing::updateStats()
+{
+    // the kernel resets the counters on every read
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+    memset(&st, 0, sizeof(st));
+    if (getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+        LOG_SYSERR << "PACKET_STATISTICS";
+        return;
+    }
+    stats_.received += st.tp_packets;
+    stats_.dropped += st.tp_drops;
+    stats_.freezes += st.tp_freeze_q_cnt;
+}
+
+bool PacketRing::captureStats(CaptureStats* stats)
+{
+    if (!valid_)
+        return false;
+    updateStats();
+    stats->received = stats_.received;
+    stats->dropped = stats_.dropped;
+    return true;
+}
+
+}
@@ -0,0 +1,94 @@
+//
+// Created by frank on 18-2-7.
+//
+
+#ifndef EVA_PACKETRING_H
+#define EVA_PACKETRING_H
+
+#include <eva/PacketSource.h>
+
+namespace eva
+{
+
+struct PacketRingOptions
+{
+    // the ring is blockCount blocks of blockSize bytes, block size must be
+    // a power of two multiple of the page size
+    uint32_t blockSize = 1 << 22;
+    uint32_t blockCount = 64;
+    // upper bound of one frame, the ring holds
+    // blockSize / frameSize * blockCount frames
+    uint32_t frameSize = 2048;
+    // the kernel hands over a partially filled block after this long
+    uint32_t retireTimeoutMs = 10;
+    // bytes kept of each frame, kHeaderSnaplen for header only capture
+    uint32_t snaplen = kFullSnaplen;
+    // read() returns 0 when no block retires for this long, -1 waits forever
+    int readTimeoutMs = -1;
+    bool promiscuous = true;
+};
+
+// AF_PACKET TPACKET_V3 capture, the kernel fills whole blocks of frames in
+// a ring shared with user space. frames are read in place and a block is
+// handed back to the kernel on the read() after its last frame.
+// ethernet and loopback interfaces only
+class PacketRing: public PacketSource
+{
+public:
+    explicit PacketRing(const char* interface,
+                        const PacketRingOptions& options = PacketRingOptions());
+    ~PacketRing() override;
+
+    bool valid() const { return valid_; }
+    const std::string& error() const { return error_; }
+
+    int linkType() const override { return DLT_EN10MB; }
+    bool isLive() const override { return true; }
+    size_t read(PacketRecord* records, size_t n) override;
+    bool setFilter(const char* expression) override;
+
+    // PACKET_STATISTICS, accumulated since the ring was opened
+    bool captureStats(CaptureStats* stats) override;
+
+    // times the ring was full and the kernel froze its queue,
+    // as of the last captureStats()
+    uint64_t freezes() const { return stats_.freezes; }
+
+private:
+    struct Stats
+    {
+        uint64_t received = 0;
+        uint64_t dropped = 0;
+        uint64_t freezes = 0;
+    };
+
+    bool setError(const char* what);
+    bool attachFilter(struct bpf_insn* insns, uint32_t count);
+    bool start();
+    bool waitBlock();
+    void releaseBlock();
+    void updateStats();
+
+    PacketRingOptions options_;
+    int fd_;
+    int ifindex_;
+    unsigned char* ring_;
+    size_t ringSize_;
+
+    bool valid_;
+    bool started_;
+    bool hasFilter_;
+    std::string error_;
+
+    // the block being read, owned by user space while |blockHeld_|
+    uint32_t block_;
+    bool blockHeld_;
+    uint32_t framesLeft_;
+    const unsigned char* nextFrame_;
+
+    Stats stats_;
+};
+
+}
+
+#endif //EVA_PACKETRING_H
@@ -0,0 +1,59 @@
+//
+// Created by frank on 18-2-6.
+//
+
+#ifndef EVA_PACKETSOURCE_H
+#define EVA_PACKETSOURCE_H
+
+#include <eva/Unit.h>
+
+namespace eva
+{
+
+// header only capture: ethernet with up to two vlan tags, ipv4 and tcp
+// with full options. dataLength comes from the ip header and the tcp
+// checksum is not verified, the analysis never looks at the payload
+const uint32_t kVlanTagLength = 4;
+const uint32_t kHeaderSnaplen = kMaxHeaderLength + 2 * kVlanTagLength;
+static_assert(kHeaderSnaplen >= kMaxHeaderLength,
+              "header only capture must keep the longest headers");
+const uint32_t kFullSnaplen = 65535;
+
+// frames seen and dropped by the kernel before reaching the capture
+struct CaptureStats
+{
+    uint64_t received = 0;
+    uint64_t dropped = 0;
+
+    void print(FILE* fp) const
+    {
+        fprintf(fp, "%lu packets received by kernel, %lu dropped\n",
+                received, dropped);
+    }
+};
+
+// where captured frames come from: a trace file or a live interface
+class PacketSource: noncopyable
+{
+public:
+    virtual ~PacketSource() = default;
+
+    virtual int linkType() const = 0;
+
+    // captured at this host, where NIC offload leaves tcp checksum unset
+    virtual bool isLive() const = 0;
+
+    // fill at most |n| records, return 0 at the end of capture.
+    // records are only valid until the next call to read()
+    virtual size_t read(PacketRecord* records, size_t n) = 0;
+
+    // only deliver frames matching the bpf |expression|
+    virtual bool setFilter(const char* expression) = 0;
+
+    // false if the source has no kernel counters, e.g. a trace file
+    virtual bool captureStats(CaptureStats* stats) = 0;
+};
+
+}
+
+#endif //EVA_PACKETSOURCE_H
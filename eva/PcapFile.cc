@@ -0,0 +1,421 @@
+//
+// Created by frank on 18-2-6.
+//
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+
+#include <eva/PcapFile.h>
+
+namespace eva
+{
+
+namespace
+{
+
+const uint32_t kPcapMagicMicro   = 0xa1b2c3d4;
+const uint32_t kPcapMagicNano    = 0xa1b23c4d;
+const uint32_t kPcapHeaderLength = 24;
+const uint32_t kPcapRecordLength = 16;
+
+const uint32_t kSectionHeaderBlock     = 0x0a0d0d0a;
+const uint32_t kInterfaceBlock         = 0x00000001;
+const uint32_t kObsoletePacketBlock    = 0x00000002;
+const uint32_t kSimplePacketBlock      = 0x00000003;
+const uint32_t kEnhancedPacketBlock    = 0x00000006;
+const uint32_t kByteOrderMagic         = 0x1a2b3c4d;
+const uint32_t kBlockOverhead          = 12; // type, length, trailing length
+
+const uint16_t kOptionEnd     = 0;
+const uint16_t kOptionTsResol = 9;
+
+// timestamp units toMicroSeconds() converts without overflow: 10^19 still
+// fits a uint64_t, and 2^44 - 1 times 10^6 does
+const uint32_t kMaxDecimalTsExponent = 19;
+const uint32_t kMaxBinaryTsExponent  = 44;
+
+uint32_t load32(const unsigned char* p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+uint32_t align4(uint32_t x)
+{
+    return (x + 3) & ~3u;
+}
+
+}
+
+PcapFile::PcapFile(const char* path)
+        : fd_(-1),
+          begin_(nullptr),
+          end_(nullptr),
+          curr_(nullptr),
+          size_(0),
+          valid_(false),
+          isPcapng_(false),
+          swapped_(false),
+          nanoSecond_(false),
+          linkType_(DLT_EN10MB),
+          skipped_(0),
+          hasFilter_(false),
+          filter_()
+{
+    fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        error_ = std::string(path) + ": " + strerror(errno);
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) < 0) {
+        error_ = std::string(path) + ": " + strerror(errno);
+        return;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ < kPcapHeaderLength) {
+        error_ = std::string(path) + ": not a pcap file";
+        return;
+    }
+
+    void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+        error_ = std::string(path) + ": mmap " + strerror(errno);
+        return;
+    }
+    // records are visited once from front to back, let the kernel
+    // read ahead aggressively and drop pages behind us
+    madvise(addr, size_, MADV_SEQUENTIAL);
+
+    begin_ = static_cast<const unsigned char*>(addr);
+    end_ = begin_ + size_;
+    curr_ = begin_;
+
+    if (!parseFileHeader()) {
+        error_ = std::string(path) + ": " + error_;
+        return;
+    }
+    valid_ = true;
+}
+
+PcapFile::~PcapFile()
+{
+    if (hasFilter_)
+        pcap_freecode(&filter_);
+    if (begin_ != nullptr)
+        munmap(const_cast<unsigned char*>(begin_), size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+uint16_t PcapFile::get16(const unsigned char* p) const
+{
+    uint16_t x;
+    memcpy(&x, p, sizeof(x));
+    return swapped_ ? __builtin_bswap16(x) : x;
+}
+
+uint32_t PcapFile::get32(const unsigned char* p) const
+{
+    uint32_t x = load32(p);
+    return swapped_ ? __builtin_bswap32(x) : x;
+}
+
+bool PcapFile::parseFileHeader()
+{
+    uint32_t magic = load32(begin_);
+
+    if (magic == kPcapMagicMicro || magic == kPcapMagicNano) {
+        swapped_ = false;
+    }
+    else if (__builtin_bswap32(magic) == kPcapMagicMicro ||
+             __builtin_bswap32(magic) == kPcapMagicNano) {
+        swapped_ = true;
+        magic = __builtin_bswap32(magic);
+    }
+    else if (magic == kSectionHeaderBlock) {
+        isPcapng_ = true;
+    }
+    else {
+        error_ = "not a pcap or pcapng file";
+        return false;
+    }
+
+    if (!isPcapng_) {
+        nanoSecond_ = magic == kPcapMagicNano;
+        // upper bits of the link type field carry the FCS length
+        linkType_ = static_cast<int>(get32(begin_ + 20) & 0xffff);
+        curr_ = begin_ + kPcapHeaderLength;
+        return true;
+    }
+
+    // walk blocks up to the first interface description,
+    // packet blocks are not allowed before it
+    while (interfaces_.empty()) {
+        if (end_ - curr_ < kBlockOverhead) {
+            error_ = "pcapng file without interface";
+            return false;
+        }
+        uint32_t type = get32(curr_);
+        if (type == kSectionHeaderBlock) {
+            if (end_ - curr_ < kBlockOverhead + 16 ||
+                !parseSectionHeader(curr_ + 8)) {
+                error_ = "bad pcapng section header";
+                return false;
+            }
+        }
+        uint32_t length = get32(curr_ + 4);
+        if (length < kBlockOverhead || length > static_cast<size_t>(end_ - curr_)) {
+            error_ = "truncated pcapng block";
+            return false;
+        }
+        if (type == kInterfaceBlock &&
+            !parseInterface(curr_ + 8, length - kBlockOverhead)) {
+            error_ = "bad pcapng interface block";
+            return false;
+        }
+        curr_ += align4(length);
+    }
+    linkType_ = interfaces_[0].linkType;
+    return true;
+}
+
+bool PcapFile::parseSectionHeader(const unsigned char* body)
+{
+    // the section header block type is a palindrome,
+    // the byte order magic tells the byte order of the section
+    uint32_t magic = load32(body);
+    if (magic == kByteOrderMagic)
+        swapped_ = false;
+    else if (__builtin_bswap32(magic) == kByteOrderMagic)
+        swapped_ = true;
+    else
+        return false;
+
+    // interface ids are local to a section
+    interfaces_.clear();
+    return true;
+}
+
+bool PcapFile::parseInterface(const unsigned char* body, uint32_t bodyLen)
+{
+    Interface iface;
+    iface.linkType = bodyLen >= 8 ? get16(body) : DLT_EN10MB;
+    iface.snaplen = bodyLen >= 8 ? get32(body + 4) : 0;
+    iface.tsBinary = false;
+    iface.tsExponent = 6;
+
+    uint32_t offset = 8;
+    while (offset + 4 <= bodyLen) {
+        uint16_t code = get16(body + offset);
+        uint16_t length = get16(body + offset + 2);
+        if (code == kOptionEnd || offset + 4 + length > bodyLen)
+            break;
+        if (code == kOptionTsResol && length >= 1) {
+            uint8_t resol = body[offset + 4];
+            iface.tsBinary = (resol & 0x80) != 0;
+            iface.tsExponent = resol & 0x7f;
+            if (iface.tsExponent > (iface.tsBinary ? kMaxBinaryTsExponent
+                                                   : kMaxDecimalTsExponent))
+                return false;
+        }
+        offset += 4 + align4(length);
+    }
+    interfaces_.push_back(iface);
+    return true;
+}
+
+int64_t PcapFile::toMicroSeconds(const Interface& iface, uint64_t ts) const
+{
+    uint32_t exp = iface.tsExponent;
+    if (iface.tsBinary) {
+        uint64_t mask = (uint64_t(1) << exp) - 1;
+        return static_cast<int64_t>((ts >> exp) * 1000000 +
+                                    ((ts & mask) * 1000000 >> exp));
+    }
+
+    if (exp == 6)
+        return static_cast<int64_t>(ts);
+    uint64_t scale = 1;
+    for (uint32_t i = std::min(exp, 6u); i < std::max(exp, 6u); i++)
+        scale *= 10;
+    return static_cast<int64_t>(exp < 6 ? ts * scale : ts / scale);
+}
+
+bool PcapFile::readPcapRecord(PacketRecord* record)
+{
+    if (end_ - curr_ < kPcapRecordLength)
+        return false;
+
+    uint32_t sec = get32(curr_);
+    uint32_t frac = get32(curr_ + 4);
+    uint32_t caplen = get32(curr_ + 8);
+    uint32_t len = get32(curr_ + 12);
+
+    if (caplen > static_cast<size_t>(end_ - curr_) - kPcapRecordLength) {
+        LOG_WARN << "pcap file truncated in the middle of a record";
+        curr_ = end_;
+        return false;
+    }
+
+    record->when = static_cast<int64_t>(sec) * Timestamp::kMicroSecondsPerSecond +
+                   (nanoSecond_ ? frac / 1000 : frac);
+    record->caplen = caplen;
+    record->len = len;
+    record->data = curr_ + kPcapRecordLength;
+
+    curr_ += kPcapRecordLength + caplen;
+    return true;
+}
+
+bool PcapFile::readPcapngRecord(PacketRecord* record)
+{
+    while (end_ - curr_ >= kBlockOverhead) {
+
+        const unsigned char* block = curr_;
+        uint32_t type = get32(block);
+
+        // a new section may switch byte order, check it before the length
+        if (type == kSectionHeaderBlock) {
+            if (end_ - block < kBlockOverhead + 16 ||
+                !parseSectionHeader(block + 8)) {
+                LOG_WARN << "bad pcapng section header";
+                curr_ = end_;
+                return false;
+            }
+        }
+
+        uint32_t length = get32(block + 4);
+        if (length < kBlockOverhead || length > static_cast<size_t>(end_ - block)) {
+            LOG_WARN << "pcapng file truncated in the middle of a block";
+            curr_ = end_;
+            return false;
+        }
+        curr_ += align4(length);
+
+        const unsigned char* body = block + 8;
+        uint32_t bodyLen = length - kBlockOverhead;
+        const Interface* iface = nullptr;
+        uint64_t ts = 0;
+        uint32_t caplen = 0, len = 0;
+        const unsigned char* data = nullptr;
+
+        switch (type) {
+            case kInterfaceBlock:
+                if (!parseInterface(body, bodyLen)) {
+                    LOG_WARN << "bad pcapng interface block";
+                    curr_ = end_;
+                    return false;
+                }
+                continue;
+
+            case kEnhancedPacketBlock:
+            case kObsoletePacketBlock: {
+                if (bodyLen < 20)
+                    continue;
+                uint32_t id = type == kEnhancedPacketBlock ?
+                              get32(body) : get16(body);
+                if (id >= interfaces_.size())
+                    continue;
+                iface = &interfaces_[id];
+                ts = uint64_t(get32(body + 4)) << 32 | get32(body + 8);
+                caplen = get32(body + 12);
+                len = get32(body + 16);
+                data = body + 20;
+                if (caplen > bodyLen - 20)
+                    continue;
+                break;
+            }
+
+            case kSimplePacketBlock: {
+                if (bodyLen < 4 || interfaces_.empty())
+                    continue;
+                // no timestamp, and captured length is implied by the
+                // snaplen of the first interface
+                iface = &interfaces_[0];
+                len = get32(body);
+                caplen = std::min(len, bodyLen - 4);
+                if (iface->snaplen > 0)
+                    caplen = std::min(caplen, iface->snaplen);
+                data = body + 4;
+                break;
+            }
+
+            default:
+                // name resolution, statistics, custom blocks...
+                continue;
+        }
+
+        if (iface->linkType != linkType_) {
+            skipped_++;
+            continue;
+        }
+
+        record->when = toMicroSeconds(*iface, ts);
+        record->caplen = caplen;
+        record->len = len;
+        record->data = data;
+        return true;
+    }
+    return false;
+}
+
+size_t PcapFile::read(PacketRecord* records, size_t n)
+{
+    size_t i = 0;
+    while (i < n) {
+        PacketRecord* record = &records[i];
+        bool ok = isPcapng_ ?
+                  readPcapngRecord(record) :
+                  readPcapRecord(record);
+        if (!ok)
+            break;
+
+        if (hasFilter_) {
+            struct pcap_pkthdr hdr;
+            hdr.ts.tv_sec = static_cast<time_t>(
+                    record->when / Timestamp::kMicroSecondsPerSecond);
+            hdr.ts.tv_usec = static_cast<suseconds_t>(
+                    record->when % Timestamp::kMicroSecondsPerSecond);
+            hdr.caplen = record->caplen;
+            hdr.len = record->len;
+            if (pcap_offline_filter(&filter_, &hdr, record->data) == 0)
+                continue;
+        }
+        i++;
+    }
+    return i;
+}
+
+bool PcapFile::setFilter(const char* expression)
+{
+    pcap_t* dead = pcap_open_dead(linkType_, 65535);
+    if (dead == nullptr) {
+        LOG_ERROR << "pcap_open_dead failed";
+        return false;
+    }
+
+    struct bpf_program program;
+    if (pcap_compile(dead, &program, expression, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        LOG_ERROR << "pcap_compile \"" << expression << "\": " << pcap_geterr(dead);
+        pcap_close(dead);
+        return false;
+    }
+    pcap_close(dead);
+
+    if (hasFilter_)
+        pcap_freecode(&filter_);
+    filter_ = program;
+    hasFilter_ = true;
+    return true;
+}
+
+}
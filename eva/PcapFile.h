@@ -0,0 +1,83 @@
+//
+// Created by frank on 18-2-6.
+//
+
+#ifndef EVA_PCAPFILE_H
+#define EVA_PCAPFILE_H
+
+#include <vector>
+
+#include <eva/PacketSource.h>
+
+namespace eva
+{
+
+// zero copy reader of classic pcap (micro and nano second) and pcapng trace
+// files. the whole file is mapped read only, records point into the mapping
+// and stay valid as long as the PcapFile lives.
+class PcapFile: public PacketSource
+{
+public:
+    explicit PcapFile(const char* path);
+    ~PcapFile() override;
+
+    // false if the file can not be mapped or is not a pcap/pcapng file
+    bool valid() const { return valid_; }
+    const std::string& error() const { return error_; }
+
+    int linkType() const override { return linkType_; }
+    bool isLive() const override { return false; }
+    size_t read(PacketRecord* records, size_t n) override;
+
+    // there is no kernel to filter a file, the bpf program
+    // runs in user space on every record
+    bool setFilter(const char* expression) override;
+    bool captureStats(CaptureStats* stats) override { return false; }
+
+    // pcapng packets from an interface whose link type differs from the
+    // first interface, which one unpack() call can not handle
+    uint64_t skipped() const { return skipped_; }
+
+private:
+    struct Interface
+    {
+        int      linkType;
+        uint32_t snaplen;
+        // timestamp unit is 10^-tsExponent (or 2^-tsExponent) second
+        bool     tsBinary;
+        uint32_t tsExponent;
+    };
+
+    bool parseFileHeader();
+    bool readPcapRecord(PacketRecord* record);
+    bool readPcapngRecord(PacketRecord* record);
+    bool parseSectionHeader(const unsigned char* body);
+    // false if the timestamp unit is not supported
+    bool parseInterface(const unsigned char* body, uint32_t bodyLen);
+    int64_t toMicroSeconds(const Interface& iface, uint64_t ts) const;
+
+    uint16_t get16(const unsigned char* p) const;
+    uint32_t get32(const unsigned char* p) const;
+
+    int fd_;
+    const unsigned char* begin_;
+    const unsigned char* end_;
+    const unsigned char* curr_;
+    size_t size_;
+
+    bool valid_;
+    std::string error_;
+    bool isPcapng_;
+    bool swapped_;
+    bool nanoSecond_;
+    int linkType_;
+    std::vector<Interface> interfaces_;
+    uint64_t skipped_;
+
+    bool hasFilter_;
+    struct bpf_program filter_;
+};
+
+}
+
+#endif //EVA_PCAPFILE_H
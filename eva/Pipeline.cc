@@ -0,0 +1,351 @@
+//
+// Created by frank on 18-2-8.
+//
+
+#include <chrono>
+#include <thread>
+
+#include <eva/Pipeline.h>
+#include <eva/ResultSink.h>
+#include <eva/SpscQueue.h>
+
+using namespace eva;
+
+namespace
+{
+
+// units moved per queue operation
+const size_t kBatchSize = 64;
+
+// how often a worker publishes its aggregate, in seconds of wall time
+const double kSnapshotInterval = 1.0;
+
+// how often every worker is told the packet time, in packet time. the
+// timer wheels tick once a second too
+const int64_t kTickInterval = Timestamp::kMicroSecondsPerSecond;
+
+// a unit with no addresses only carries the capture's packet time to a
+// worker, whose shard may be quiet while other shards are busy. no tcp
+// segment goes from 0.0.0.0 to 0.0.0.0, and taking one for a tick would
+// only advance the timers to its time as tracking it would
+Unit makeTick(Timestamp when)
+{
+    Unit tick = Unit();
+    tick.when = when;
+    return tick;
+}
+
+bool isTick(const Unit& unit)
+{
+    return unit.srcIP == 0 && unit.dstIP == 0;
+}
+
+// wait on a queue that is empty (or full): yield for a few polls, which
+// costs no latency under load, then sleep longer and longer up to a
+// millisecond, so an idle pipeline does not keep its cores busy. a
+// millisecond of units fits in a queue of kDefaultQueueCapacity at
+// several million units per second
+class Backoff
+{
+public:
+    Backoff(): polls_(0) {}
+
+    void reset() { polls_ = 0; }
+
+    // after a poll that moved nothing
+    void pause()
+    {
+        if (polls_ < kSpinPolls) {
+            polls_++;
+            std::this_thread::yield();
+            return;
+        }
+        int shift = std::min(polls_ - kSpinPolls, kMaxShift);
+        if (shift < kMaxShift)
+            polls_++;
+        std::this_thread::sleep_for(std::chrono::microseconds(1 << shift));
+    }
+
+    bool sleeping() const { return polls_ >= kSpinPolls; }
+
+private:
+    static const int kSpinPolls = 64;
+    // 1 << 10 us, about a millisecond
+    static const int kMaxShift = 10;
+
+    int polls_;
+};
+
+// std::min() takes it by reference
+const int Backoff::kMaxShift;
+
+}
+
+const size_t Pipeline::kMaxWorkers;
+
+bool eva::parseWorkerCount(const char* count, size_t* nWorkers)
+{
+    char* end;
+    unsigned long n = strtoul(count, &end, 10);
+    if (end == count || *end != '\0' || n == 0 ||
+        n > Pipeline::kMaxWorkers) {
+        LOG_ERROR << "bad thread count " << count
+                  << ", should be 1 to " << Pipeline::kMaxWorkers;
+        return false;
+    }
+    *nWorkers = n;
+    return true;
+}
+
+struct Pipeline::Worker
+{
+    Worker(uint32_t srcIP,
+           uint32_t dstIP,
+           const FlowTimeouts& timeouts,
+           bool duplex,
+           bool screen,
+           size_t queueCapacity)
+            : queue(queueCapacity),
+              tracker(srcIP, dstIP, timeouts, duplex, screen),
+              done(false),
+              published(nullptr),
+              lastPublished(Timestamp::now()),
+              staged(0)
+    {}
+
+    ~Worker()
+    {
+        delete published.load(std::memory_order_acquire);
+    }
+
+    void run()
+    {
+        Unit units[kBatchSize];
+        Backoff backoff;
+        for (;;) {
+            size_t n = queue.pop(units, kBatchSize);
+            if (n == 0) {
+                // everything pushed before |done| is visible after it
+                if (done.load(std::memory_order_acquire) &&
+                    (n = queue.pop(units, kBatchSize)) == 0)
+                    break;
+                if (n == 0) {
+                    // the clock is read once per sleep, not per poll
+                    if (backoff.sleeping())
+                        publish();
+                    backoff.pause();
+                    continue;
+                }
+            }
+            backoff.reset();
+            size_t ticks = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (isTick(units[i])) {
+                    tracker.advance(units[i].when);
+                    ticks++;
+                }
+                else
+                    tracker.onUnit(&units[i]);
+            }
+            metrics.publish(tracker, n - ticks);
+            publish();
+        }
+        tracker.clear();
+        metrics.publish(tracker, 0);
+    }
+
+    // hand a copy of the aggregate to the capture side now and then. the
+    // capture side takes the latest with an exchange too, so each copy
+    // is only ever used by one side
+    void publish()
+    {
+        Timestamp now = Timestamp::now();
+        if (timeDifference(now, lastPublished) < kSnapshotInterval)
+            return;
+        lastPublished = now;
+        auto snapshot = new ResultAggregate(tracker.aggregate());
+        delete published.exchange(snapshot, std::memory_order_acq_rel);
+    }
+
+    SpscQueue<Unit> queue;
+    FlowTracker tracker;
+    FlowMetrics metrics;
+    std::atomic<bool> done;
+    std::thread thread;
+
+    std::atomic<ResultAggregate*> published;
+    Timestamp lastPublished;
+    // capture side, the last snapshot taken
+    std::unique_ptr<ResultAggregate> latest;
+
+    // producer side batch
+    Unit stage[kBatchSize];
+    size_t staged;
+};
+
+Pipeline::Pipeline(size_t nWorkers,
+                   uint32_t srcIP,
+                   uint32_t dstIP,
+                   const FlowTimeouts& timeouts,
+                   bool duplex,
+                   bool screen,
+                   size_t queueCapacity)
+        : nWorkers_(std::max(nWorkers, size_t(1))),
+          inlineTracker_(srcIP, dstIP, timeouts, duplex, screen),
+          finished_(false)
+{
+    if (nWorkers_ == 1)
+        return;
+
+    for (size_t i = 0; i < nWorkers_; i++) {
+        workers_.emplace_back(new Worker(srcIP, dstIP, timeouts,
+                                         duplex, screen, queueCapacity));
+        Worker* worker = workers_.back().get();
+        worker->thread = std::thread([worker]() { worker->run(); });
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    finish();
+}
+
+void Pipeline::dispatch(Unit* units, size_t n)
+{
+    if (workers_.empty()) {
+        for (size_t i = 0; i < n; i++)
+            inlineTracker_.onUnit(&units[i]);
+        inlineMetrics_.publish(inlineTracker_, n);
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        stage(workers_[units[i].hashCode % nWorkers_].get(), units[i]);
+
+    // behind the units of the batch, so a worker never expires a flow
+    // whose units are still queued
+    if (n > 0 && units[n - 1].when - lastTick_ >= kTickInterval) {
+        lastTick_ = units[n - 1].when;
+        for (auto& worker: workers_)
+            stage(worker.get(), makeTick(lastTick_));
+    }
+
+    // units of one capture batch must not wait for the next one
+    for (auto& worker: workers_) {
+        if (worker->staged > 0)
+            flush(worker.get());
+    }
+}
+
+void Pipeline::stage(Worker* worker, const Unit& unit)
+{
+    worker->stage[worker->staged++] = unit;
+    if (worker->staged == kBatchSize)
+        flush(worker);
+}
+
+void Pipeline::flush(Worker* worker)
+{
+    size_t pushed = 0;
+    Backoff backoff;
+    while (pushed < worker->staged) {
+        size_t n = worker->queue.push(worker->stage + pushed,
+                                      worker->staged - pushed);
+        if (n == 0)
+            backoff.pause();
+        else
+            backoff.reset();
+        pushed += n;
+    }
+    worker->staged = 0;
+}
+
+void Pipeline::finish()
+{
+    if (finished_)
+        return;
+    finished_ = true;
+
+    inlineTracker_.clear();
+    inlineMetrics_.publish(inlineTracker_, 0);
+    for (auto& worker: workers_) {
+        flush(worker.get());
+        worker->done.store(true, std::memory_order_release);
+    }
+    for (auto& worker: workers_) {
+        worker->thread.join();
+    }
+
+    // the totals of the run, once, after a row per server port
+    aggregate_ = inlineTracker_.aggregate();
+    for (auto& worker: workers_)
+        aggregate_.merge(worker->tracker.aggregate());
+    for (auto& port: aggregate_.ports()) {
+        PortResult result;
+        result.port = port.first;
+        result.totals = port.second;
+        resultSink().onPortTotals(result);
+    }
+    resultSink().onTotals(aggregate_.total());
+    resultSink().flush();
+}
+
+ResultAggregate Pipeline::snapshot()
+{
+    if (finished_)
+        return aggregate_;
+
+    ResultAggregate merged(inlineTracker_.aggregate());
+    for (auto& worker: workers_) {
+        auto snapshot = worker->published.exchange(nullptr,
+                                                   std::memory_order_acq_rel);
+        if (snapshot != nullptr)
+            worker->latest.reset(snapshot);
+        if (worker->latest)
+            merged.merge(*worker->latest);
+    }
+    return merged;
+}
+
+void Pipeline::sample(FlowSample* flows,
+                      std::vector<size_t>* queueDepths) const
+{
+    inlineMetrics_.addTo(flows);
+    queueDepths->clear();
+    for (auto& worker: workers_) {
+        worker->metrics.addTo(flows);
+        queueDepths->push_back(worker->queue.size());
+    }
+}
+
+bool Pipeline::analyzed() const
+{
+    bool analyzed = inlineTracker_.analyzed();
+    for (auto& worker: workers_)
+        analyzed = analyzed || worker->tracker.analyzed();
+    return analyzed;
+}
+
+uint64_t Pipeline::flowCount() const
+{
+    uint64_t count = inlineTracker_.flowCount();
+    for (auto& worker: workers_)
+        count += worker->tracker.flowCount();
+    return count;
+}
+
+uint64_t Pipeline::expiredCount() const
+{
+    uint64_t count = inlineTracker_.expiredCount();
+    for (auto& worker: workers_)
+        count += worker->tracker.expiredCount();
+    return count;
+}
+
+uint64_t Pipeline::promotedCount() const
+{
+    uint64_t count = inlineTracker_.promotedCount();
+    for (auto& worker: workers_)
+        count += worker->tracker.promotedCount();
+    return count;
+}
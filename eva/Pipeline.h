@@ -0,0 +1,79 @@
+//
+// Created by frank on 18-2-8.
+//
+
+#ifndef EVA_PIPELINE_H
+#define EVA_PIPELINE_H
+
+#include <memory>
+
+#include <eva/FlowTracker.h>
+#include <eva/Metrics.h>
+
+namespace eva
+{
+
+// a worker count from 1 to Pipeline::kMaxWorkers
+bool parseWorkerCount(const char* count, size_t* nWorkers);
+
+// the capture thread parses units and dispatches them by Unit::hashCode,
+// which is the same for both directions of a flow, to worker threads.
+// each worker owns a FlowTracker, so a flow is always analyzed in order
+// on one thread. with one worker the units are tracked on the calling
+// thread and no thread is started
+class Pipeline: noncopyable
+{
+public:
+    static const size_t kDefaultQueueCapacity = 8192;
+    static const size_t kMaxWorkers = 256;
+
+    Pipeline(size_t nWorkers,
+             uint32_t srcIP,
+             uint32_t dstIP,
+             const FlowTimeouts& timeouts = FlowTimeouts(),
+             bool duplex = false,
+             bool screen = false,
+             size_t queueCapacity = kDefaultQueueCapacity);
+    ~Pipeline();
+
+    // capture thread only, block while a worker queue is full
+    void dispatch(Unit* units, size_t n);
+
+    // wait for the workers to drain their queues, end all flows and join.
+    // then report the totals of the run and flush the results
+    void finish();
+
+    // capture thread only. the round trips analyzed so far, merged from
+    // what each worker published within the last second or so. exact
+    // after finish()
+    ResultAggregate snapshot();
+
+    // any thread. the counters the trackers published after their last
+    // batch, and the units waiting in each worker queue
+    void sample(FlowSample* flows, std::vector<size_t>* queueDepths) const;
+
+    // valid after finish()
+    bool analyzed() const;
+    uint64_t flowCount() const;
+    uint64_t expiredCount() const;
+    uint64_t promotedCount() const;
+    size_t workerCount() const { return nWorkers_; }
+
+private:
+    struct Worker;
+
+    void stage(Worker* worker, const Unit& unit);
+    void flush(Worker* worker);
+
+    const size_t nWorkers_;
+    FlowTracker inlineTracker_;
+    FlowMetrics inlineMetrics_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    Timestamp lastTick_;            // packet time of the last tick sent
+    ResultAggregate aggregate_;     // of the run, set by finish()
+    bool finished_;
+};
+
+}
+
+#endif //EVA_PIPELINE_H
@@ -0,0 +1,143 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <mutex>
+#include <memory>
+
+#include <eva/Profile.h>
+
+using namespace eva;
+
+namespace
+{
+
+const char* const kStageNames[] = {
+        "read",
+        "unpack",
+        "lookup",
+        "data_unit",
+        "ack_unit",
+        "roundtrip",
+};
+
+static_assert(sizeof(kStageNames) / sizeof(kStageNames[0]) ==
+              kNProfileStages, "a name per stage");
+
+// every profile ever created, never freed
+std::mutex profilesMutex;
+std::vector<std::unique_ptr<StageProfile>> profiles;
+
+thread_local StageProfile* localProfile = nullptr;
+
+// TSC and wall clock when the first profile was created, the cycle rate
+// is measured over the whole run
+uint64_t startTsc;
+Timestamp startTime;
+
+}
+
+uint32_t detail::samplingPeriod = 256;
+__thread uint32_t detail::samplingCountdown[kNProfileStages];
+
+const char* eva::profileStageName(ProfileStage stage)
+{
+    return kStageNames[stage];
+}
+
+uint64_t StageSummary::quantile(double q) const
+{
+    auto rank = static_cast<uint64_t>(q * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > rank)
+            return StageHistogram::lowerBound(static_cast<int>(i));
+    }
+    return max;
+}
+
+StageHistogram::StageHistogram()
+        : count_(0),
+          sum_(0),
+          max_(0)
+{
+    for (auto& bucket: buckets_)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+void StageHistogram::mergeInto(StageSummary* summary) const
+{
+    summary->buckets.resize(kBuckets);
+    for (int i = 0; i < kBuckets; i++)
+        summary->buckets[i] += buckets_[i].load(std::memory_order_relaxed);
+    summary->count += count_.load(std::memory_order_relaxed);
+    summary->sum += sum_.load(std::memory_order_relaxed);
+    summary->max = std::max(summary->max,
+                            max_.load(std::memory_order_relaxed));
+}
+
+StageProfile& StageProfile::local()
+{
+    if (localProfile == nullptr) {
+        std::lock_guard<std::mutex> lock(profilesMutex);
+        if (profiles.empty()) {
+            startTsc = readTsc();
+            startTime = Timestamp::now();
+        }
+        profiles.emplace_back(new StageProfile);
+        localProfile = profiles.back().get();
+    }
+    return *localProfile;
+}
+
+void eva::setProfileSampling(uint32_t period)
+{
+    detail::samplingPeriod = period;
+    for (auto& countdown: detail::samplingCountdown)
+        countdown = 0;
+}
+
+void eva::sampleProfile(std::vector<StageSummary>* stages, double* nsPerCycle)
+{
+    stages->clear();
+    *nsPerCycle = 0;
+
+    std::lock_guard<std::mutex> lock(profilesMutex);
+    if (profiles.empty())
+        return;
+    stages->resize(kNProfileStages);
+    for (auto& profile: profiles) {
+        for (int i = 0; i < kNProfileStages; i++)
+            profile->stage(static_cast<ProfileStage>(i))
+                    .mergeInto(&(*stages)[i]);
+    }
+
+    uint64_t cycles = readTsc() - startTsc;
+    int64_t us = Timestamp::now() - startTime;
+    if (cycles > 0)
+        *nsPerCycle = static_cast<double>(us) * 1000 /
+                      static_cast<double>(cycles);
+}
+
+void eva::printProfile(FILE* fp)
+{
+    std::vector<StageSummary> stages;
+    double nsPerCycle;
+    sampleProfile(&stages, &nsPerCycle);
+
+    auto ns = [nsPerCycle](uint64_t cycles) {
+        return static_cast<double>(cycles) * nsPerCycle;
+    };
+    for (size_t i = 0; i < stages.size(); i++) {
+        auto& s = stages[i];
+        if (s.count == 0)
+            continue;
+        fprintf(fp, "%-10s %10lu samples, ns mean %.1f "
+                    "p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+                kStageNames[i], s.count,
+                ns(s.sum) / static_cast<double>(s.count),
+                ns(s.quantile(0.5)), ns(s.quantile(0.9)),
+                ns(s.quantile(0.99)), ns(s.max));
+    }
+}
@@ -0,0 +1,217 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#ifndef EVA_PROFILE_H
+#define EVA_PROFILE_H
+
+#include <atomic>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// where the packet path spends its cycles. stages are timed with the TSC
+// into a log linear histogram per thread. profiling is compiled in with
+// -DEVA_PROFILE (cmake -DEVA_PROFILE=ON), without it StageTimer is empty
+// and costs nothing. times are inclusive, the ack unit stage contains
+// the round trip stage
+enum ProfileStage
+{
+    kStageRead,         // PacketSource::read(), per frame of a batch
+    kStageUnpack,       // unpackBatch(), per frame of a batch
+    kStageLookup,       // flow table lookup and insert
+    kStageDataUnit,     // TcpFlow::onDataUnit()
+    kStageAckUnit,      // TcpFlow::onAckUnit()
+    kStageRoundtrip,    // onNewRoundtrip() and its report
+    kNProfileStages,
+};
+
+const char* profileStageName(ProfileStage stage);
+
+#ifdef EVA_PROFILE
+const bool kProfileEnabled = true;
+#else
+const bool kProfileEnabled = false;
+#endif
+
+inline uint64_t readTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 +
+           static_cast<uint64_t>(ts.tv_nsec);
+#endif
+}
+
+// a histogram merged from the threads' ones, cycles
+struct StageSummary
+{
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    // the lower bound of the bucket holding quantile |q|, within 1/8
+    uint64_t quantile(double q) const;
+};
+
+// cycles per sample in buckets of 1/8 of a power of two: values below 8
+// have a bucket each, then each [2^k, 2^(k+1)) is split into 8. only the
+// owner thread adds, any thread may read
+class StageHistogram: noncopyable
+{
+public:
+    static const int kSubBits = 3;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+    StageHistogram();
+
+    // |cycles| spent on |count| items, each counted at the average
+    void add(uint64_t cycles, uint64_t count = 1)
+    {
+        uint64_t each = cycles / count;
+        bump(&buckets_[bucketOf(each)], count);
+        bump(&count_, count);
+        bump(&sum_, cycles);
+        if (each > max_.load(std::memory_order_relaxed))
+            max_.store(each, std::memory_order_relaxed);
+    }
+
+    void mergeInto(StageSummary* summary) const;
+
+    static int bucketOf(uint64_t value)
+    {
+        if (value < kSubBuckets)
+            return static_cast<int>(value);
+        int msb = 63 - __builtin_clzll(value);
+        int sub = static_cast<int>(value >> (msb - kSubBits)) &
+                  (kSubBuckets - 1);
+        return (msb - kSubBits + 1) * kSubBuckets + sub;
+    }
+
+    static uint64_t lowerBound(int bucket)
+    {
+        if (bucket < kSubBuckets)
+            return static_cast<uint64_t>(bucket);
+        int msb = bucket / kSubBuckets + kSubBits - 1;
+        uint64_t sub = static_cast<uint64_t>(bucket % kSubBuckets);
+        return (kSubBuckets + sub) << (msb - kSubBits);
+    }
+
+private:
+    // the owner is the only writer, no need for an atomic add
+    static void bump(std::atomic<uint64_t>* counter, uint64_t n)
+    {
+        counter->store(counter->load(std::memory_order_relaxed) + n,
+                       std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets_[kBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+// the histograms of one thread
+class StageProfile: noncopyable
+{
+public:
+    StageHistogram& stage(ProfileStage s) { return stages_[s]; }
+    const StageHistogram& stage(ProfileStage s) const { return stages_[s]; }
+
+    // the calling thread's profile, created on first use. profiles
+    // outlive their threads, so the workers' count after they joined
+    static StageProfile& local();
+
+private:
+    StageHistogram stages_[kNProfileStages];
+};
+
+// time every |period|th stage a thread enters, 1 times all of them and 0
+// none. call it before the threads that profile start. reading the TSC
+// twice costs about as much as a lookup, the default of 256 keeps a
+// profiling build within a few percent of one without
+void setProfileSampling(uint32_t period);
+
+namespace detail
+{
+
+extern uint32_t samplingPeriod;
+// one per stage, stages that always come in the same order would alias
+// on a shared one. __thread as in muduo: an extern thread_local would be
+// reached through a wrapper call on every stage
+extern __thread uint32_t samplingCountdown[kNProfileStages];
+
+// the first entry of a stage is sampled
+inline bool sampleStage(ProfileStage stage)
+{
+    uint32_t& countdown = samplingCountdown[stage];
+    if (countdown-- != 0)
+        return false;
+    // period 0 wraps around and never samples again
+    countdown = samplingPeriod - 1;
+    return samplingPeriod != 0;
+}
+
+}
+
+// time a stage from construction to stop() or destruction, if sampled
+#ifdef EVA_PROFILE
+class StageTimer: noncopyable
+{
+public:
+    explicit StageTimer(ProfileStage stage)
+            : stage_(stage),
+              start_(detail::sampleStage(stage) ? readTsc() : 0)
+    {}
+
+    ~StageTimer() { stop(); }
+
+    // the stage handled |count| items, e.g. the frames of a batch
+    void stop(size_t count = 1)
+    {
+        if (start_ == 0)
+            return;
+        uint64_t cycles = readTsc() - start_;
+        start_ = 0;
+        if (count > 0)
+            StageProfile::local().stage(stage_).add(cycles, count);
+    }
+
+private:
+    const ProfileStage stage_;
+    uint64_t start_;
+};
+#else
+class StageTimer: noncopyable
+{
+public:
+    explicit StageTimer(ProfileStage) {}
+    void stop(size_t = 1) {}
+};
+#endif
+
+// the histograms of all threads merged, indexed by ProfileStage, and how
+// many ns a cycle took since the first profile was created. empty when
+// profiling is compiled out
+void sampleProfile(std::vector<StageSummary>* stages, double* nsPerCycle);
+
+// a line per stage that was sampled: count, mean and quantiles in ns
+void printProfile(FILE* fp);
+
+}
+
+#endif //EVA_PROFILE_H
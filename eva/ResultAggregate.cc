@@ -0,0 +1,53 @@
+//
+// Created by frank on 18-2-13.
+//
+
+#include <eva/ResultAggregate.h>
+
+using namespace eva;
+
+void ResultAggregate::add(uint16_t port, RoundtripLimit limit,
+                          int64_t start, int64_t end, int64_t bytes)
+{
+    if (limit != kUnknownLimit) {
+        // duration in ms, as reported
+        int64_t duration = (end - start) / 1000;
+        total_.add(limit, duration, bytes);
+        ports_[port].add(limit, duration, bytes);
+    }
+
+    if (start_ == 0 || start < start_)
+        start_ = start;
+    end_ = std::max(end_, end);
+}
+
+void ResultAggregate::merge(const ResultAggregate& other)
+{
+    total_.merge(other.total_);
+    for (auto& port: other.ports_)
+        ports_[port.first].merge(port.second);
+    flowCount_ += other.flowCount_;
+
+    if (other.start_ != 0 && (start_ == 0 || other.start_ < start_))
+        start_ = other.start_;
+    end_ = std::max(end_, other.end_);
+}
+
+void ResultAggregate::print(FILE* file) const
+{
+    int64_t roundtrips = 0;
+    for (int i = 0; i < kNOutput; i++)
+        roundtrips += total_.flights[i];
+    fprintf(file, "%lu flows, %ld round trips", flowCount_, roundtrips);
+    if (start_ != 0)
+        fprintf(file, " %s -> %s",
+                extractHours(Timestamp(start_)).c_str(),
+                extractHours(Timestamp(end_)).c_str());
+    for (int i = 0; i < kNOutput; i++) {
+        if (total_.flights[i] > 0)
+            fprintf(file, ", %s %ld",
+                    roundtripLimitName(static_cast<RoundtripLimit>(i)),
+                    total_.flights[i]);
+    }
+    fprintf(file, "\n");
+}
@@ -0,0 +1,67 @@
+//
+// Created by frank on 18-2-13.
+//
+
+#ifndef EVA_RESULTAGGREGATE_H
+#define EVA_RESULTAGGREGATE_H
+
+#include <map>
+
+#include <eva/ResultSink.h>
+
+namespace eva
+{
+
+// the round trips of a set of flows rolled up per limit, overall and per
+// server port, and the span of packet time they cover. each pipeline
+// worker owns one and adds to it without locking; the workers' aggregates
+// are merged for snapshots and for the totals of a run
+class ResultAggregate
+{
+public:
+    ResultAggregate()
+            : total_(),
+              flowCount_(0),
+              start_(0),
+              end_(0)
+    {}
+
+    // a round trip of a flow to or from server |port|, from the first
+    // ack at |start| to |end|, us since epoch. unknown limited round
+    // trips only extend the time span
+    void add(uint16_t port, RoundtripLimit limit,
+             int64_t start, int64_t end, int64_t bytes);
+
+    // a flow with round trips ended
+    void onFlowEnd() { flowCount_++; }
+
+    void merge(const ResultAggregate& other);
+
+    const ResultTotals& total() const { return total_; }
+    const std::map<uint16_t, ResultTotals>& ports() const { return ports_; }
+    uint64_t flowCount() const { return flowCount_; }
+
+    // first and last round trip time, 0 before any round trip
+    int64_t start() const { return start_; }
+    int64_t end() const { return end_; }
+
+    // one line of the flows, round trips per limit and time span so far
+    void print(FILE* file) const;
+
+    // the well known end of a flow, taken as the lower port
+    static uint16_t serverPort(const InetAddress& src, const InetAddress& dst)
+    {
+        return std::min(src.toPort(), dst.toPort());
+    }
+
+private:
+    ResultTotals total_;
+    std::map<uint16_t, ResultTotals> ports_;
+    uint64_t flowCount_;
+    int64_t start_;
+    int64_t end_;
+};
+
+}
+
+#endif //EVA_RESULTAGGREGATE_H
@@ -0,0 +1,307 @@
+//
+// Created by frank on 18-2-13.
+//
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <chrono>
+
+#include <eva/ResultSink.h>
+
+using namespace eva;
+
+namespace
+{
+
+enum RecordType: uint8_t
+{
+    kRoundtripRecord,
+    kTimeoutRecord,
+    kFlowTotalsRecord,
+    kPortTotalsRecord,
+    kTotalsRecord,
+};
+
+ResultSink* installedSink = nullptr;
+
+// indexed by RoundtripLimit
+const char* const kLimitLabels[] = {
+        "[slow start]",
+        "[application limited]",
+        "(buffer)[kernel limited]",
+        "(cc)[kernel limited]",
+        "[receiver limited]",
+        "[bandwidth limited]",
+        "[congestion limited]",
+        "[buffer bloat]",
+        "[unknown limited]",
+};
+
+static_assert(sizeof(kLimitLabels) / sizeof(kLimitLabels[0]) ==
+              kUnknownLimit + 1, "a label per limit");
+
+const char* const kLimitNames[] = {
+        "slow_start",
+        "application",
+        "send_buffer",
+        "congestion_control",
+        "receive_window",
+        "bandwidth",
+        "congestion",
+        "bufferbloat",
+        "unknown",
+};
+
+static_assert(sizeof(kLimitNames) / sizeof(kLimitNames[0]) ==
+              kUnknownLimit + 1, "a name per limit");
+
+void formatRoundtrip(const RoundtripResult& r, std::string* out)
+{
+    char buf[256];
+    // the round trip is right aligned in 6 columns with its " ["
+    int n = snprintf(buf, sizeof(buf), "%6s%u] %ldkB/s %ldus %s -> %s %s",
+                     " [", r.roundtrip, r.btlbw, r.rtprop,
+                     extractHours(Timestamp(r.start)).c_str(),
+                     extractHours(Timestamp(r.end)).c_str(),
+                     kLimitLabels[r.limit]);
+    out->append(buf, static_cast<size_t>(n));
+    if (r.limit == kBufferbloat)
+        out->append("\n");
+    else {
+        n = snprintf(buf, sizeof(buf), " (%d/%d)\n", r.votes, r.total);
+        out->append(buf, static_cast<size_t>(n));
+    }
+}
+
+void formatTimeout(const TimeoutResult& r, std::string* out)
+{
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf),
+                     "[%u] %ldkB/s %ldus %s -> %s [timeout rexmit]\n",
+                     r.roundtrip, r.btlbw, r.rtprop,
+                     extractHours(Timestamp(r.first)).c_str(),
+                     extractHours(Timestamp(r.rexmit)).c_str());
+    out->append(buf, static_cast<size_t>(n));
+}
+
+void formatColumns(const int64_t* values, std::string* out)
+{
+    char buf[32];
+    for (int i = 0; i < kNOutput; i++) {
+        int n = snprintf(buf, sizeof(buf), "%ld ", values[i]);
+        out->append(buf, static_cast<size_t>(n));
+    }
+}
+
+void formatTotals(const ResultTotals& totals, std::string* out)
+{
+    formatColumns(totals.duration, out);
+    out->append("   ");
+    formatColumns(totals.bytes, out);
+    out->append("   ");
+    formatColumns(totals.flights, out);
+    out->append("\n");
+}
+
+// e.g. "flow 10.0.0.1:80 -> 10.0.0.2:40000 " before the totals
+void formatFlow(const FlowResult& r, std::string* out)
+{
+    char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &r.srcIP, src, sizeof(src));
+    inet_ntop(AF_INET, &r.dstIP, dst, sizeof(dst));
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "flow %s:%u -> %s:%u ",
+                     src, r.srcPort, dst, r.dstPort);
+    out->append(buf, static_cast<size_t>(n));
+    formatTotals(r.totals, out);
+}
+
+void formatPort(const PortResult& r, std::string* out)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "port %u ", r.port);
+    out->append(buf, static_cast<size_t>(n));
+    formatTotals(r.totals, out);
+}
+
+template <typename Record>
+const char* decode(const char* p, Record* record)
+{
+    memcpy(record, p, sizeof(Record));
+    return p + sizeof(Record);
+}
+
+}
+
+AsyncResultWriter::AsyncResultWriter(FILE* file, int flushInterval)
+        : file_(file),
+          flushInterval_(flushInterval),
+          current_(new Buffer),
+          handedOff_(0),
+          written_(0),
+          running_(true)
+{
+    current_->reserve(kBufferSize);
+    thread_ = std::thread([this]() { threadFunc(); });
+}
+
+AsyncResultWriter::~AsyncResultWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_one();
+    thread_.join();
+}
+
+void AsyncResultWriter::onRoundtrip(const RoundtripResult& result)
+{
+    append(kRoundtripRecord, &result, sizeof(result));
+}
+
+void AsyncResultWriter::onTimeoutRexmit(const TimeoutResult& result)
+{
+    append(kTimeoutRecord, &result, sizeof(result));
+}
+
+void AsyncResultWriter::onFlowTotals(const FlowResult& result)
+{
+    append(kFlowTotalsRecord, &result, sizeof(result));
+}
+
+void AsyncResultWriter::onPortTotals(const PortResult& result)
+{
+    append(kPortTotalsRecord, &result, sizeof(result));
+}
+
+void AsyncResultWriter::onTotals(const ResultTotals& totals)
+{
+    append(kTotalsRecord, &totals, sizeof(totals));
+}
+
+void AsyncResultWriter::append(uint8_t type, const void* record, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (current_->size() + 1 + len > kBufferSize) {
+        handOff();
+        cond_.notify_one();
+    }
+    auto p = static_cast<const char*>(record);
+    current_->push_back(static_cast<char>(type));
+    current_->insert(current_->end(), p, p + len);
+}
+
+void AsyncResultWriter::handOff()
+{
+    full_.push_back(std::move(current_));
+    handedOff_++;
+    if (spare_.empty()) {
+        current_.reset(new Buffer);
+        current_->reserve(kBufferSize);
+    }
+    else {
+        current_ = std::move(spare_.back());
+        spare_.pop_back();
+    }
+}
+
+void AsyncResultWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!current_->empty())
+        handOff();
+    uint64_t target = handedOff_;
+    cond_.notify_one();
+    flushed_.wait(lock, [this, target]() { return written_ >= target; });
+}
+
+void AsyncResultWriter::threadFunc()
+{
+    std::vector<BufferPtr> buffers;
+    std::string text;
+    for (;;) {
+        bool running;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (full_.empty() && running_)
+                cond_.wait_for(lock, std::chrono::seconds(flushInterval_));
+            // on a timeout or at the end, take the partial buffer too
+            if (!current_->empty() && (full_.empty() || !running_))
+                handOff();
+            buffers.swap(full_);
+            running = running_;
+        }
+
+        for (auto& buffer: buffers) {
+            text.clear();
+            const char* p = buffer->data();
+            const char* end = p + buffer->size();
+            while (p < end) {
+                auto type = static_cast<uint8_t>(*p++);
+                if (type == kRoundtripRecord) {
+                    RoundtripResult result;
+                    p = decode(p, &result);
+                    formatRoundtrip(result, &text);
+                }
+                else if (type == kTimeoutRecord) {
+                    TimeoutResult result;
+                    p = decode(p, &result);
+                    formatTimeout(result, &text);
+                }
+                else if (type == kFlowTotalsRecord) {
+                    FlowResult result;
+                    p = decode(p, &result);
+                    formatFlow(result, &text);
+                }
+                else if (type == kPortTotalsRecord) {
+                    PortResult result;
+                    p = decode(p, &result);
+                    formatPort(result, &text);
+                }
+                else {
+                    assert(type == kTotalsRecord);
+                    ResultTotals totals;
+                    p = decode(p, &totals);
+                    formatTotals(totals, &text);
+                }
+            }
+            if (fwrite(text.data(), 1, text.size(), file_) != text.size())
+                LOG_SYSERR << "write results";
+        }
+        fflush(file_);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            written_ += buffers.size();
+            for (auto& buffer: buffers) {
+                buffer->clear();
+                spare_.push_back(std::move(buffer));
+            }
+        }
+        buffers.clear();
+        flushed_.notify_all();
+
+        if (!running)
+            break;
+    }
+}
+
+const char* eva::roundtripLimitName(RoundtripLimit limit)
+{
+    return kLimitNames[limit];
+}
+
+ResultSink& eva::resultSink()
+{
+    if (installedSink != nullptr)
+        return *installedSink;
+    static AsyncResultWriter stdoutWriter(stdout);
+    return stdoutWriter;
+}
+
+void eva::setResultSink(ResultSink* sink)
+{
+    installedSink = sink;
+}
@@ -0,0 +1,189 @@
+//
+// Created by frank on 18-2-13.
+//
+
+#ifndef EVA_RESULTSINK_H
+#define EVA_RESULTSINK_H
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <memory>
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// what a round trip is reported limited by. the first kNOutput are also
+// the columns of the totals
+enum RoundtripLimit
+{
+    kSlowStart,
+    kApplication,
+    kSendBuffer,
+    kCongestionControl,
+    kReceiveWindow,
+    kBandwidth,
+    kCongestion,
+    kBufferbloat,
+    kNOutput,
+    kUnknownLimit = kNOutput,
+};
+
+// a short name, e.g. "slow_start", for labels and metrics
+const char* roundtripLimitName(RoundtripLimit limit);
+
+// results are compact binary records, times are us since epoch. they are
+// formatted, if at all, by the sink
+struct RoundtripResult
+{
+    int64_t  start;     // first ack of the round trip
+    int64_t  end;
+    int64_t  btlbw;     // kB/s
+    int64_t  rtprop;    // us
+    uint32_t roundtrip;
+    int32_t  votes;     // for the limit, not counted for buffer bloat
+    int32_t  total;
+    uint8_t  limit;     // RoundtripLimit
+};
+
+struct TimeoutResult
+{
+    int64_t  first;     // first transmit of the retransmitted unit
+    int64_t  rexmit;
+    int64_t  btlbw;
+    int64_t  rtprop;
+    uint32_t roundtrip;
+};
+
+// round trips per limit, value initialize to zero
+struct ResultTotals
+{
+    int64_t duration[kNOutput];     // ms
+    int64_t bytes[kNOutput];
+    int64_t flights[kNOutput];
+
+    void add(RoundtripLimit limit, int64_t durationMs, int64_t flightBytes)
+    {
+        assert(limit < kNOutput);
+        duration[limit] += durationMs;
+        bytes[limit] += flightBytes;
+        flights[limit]++;
+    }
+
+    void merge(const ResultTotals& other)
+    {
+        for (int i = 0; i < kNOutput; i++) {
+            duration[i] += other.duration[i];
+            bytes[i] += other.bytes[i];
+            flights[i] += other.flights[i];
+        }
+    }
+};
+
+// the totals of one flow, reported as it ends
+struct FlowResult
+{
+    uint32_t srcIP;     // network order
+    uint32_t dstIP;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    ResultTotals totals;
+};
+
+// the totals of the flows to or from a server port, reported at the end
+// of a run before the totals of all
+struct PortResult
+{
+    uint16_t port;
+    ResultTotals totals;
+};
+
+// where analyzers report to. pipeline workers call on*() at the same
+// time, a sink serializes them itself. the records of one flow come from
+// one worker, so they arrive in order
+class ResultSink: noncopyable
+{
+public:
+    virtual ~ResultSink() = default;
+
+    virtual void onRoundtrip(const RoundtripResult& result) = 0;
+    virtual void onTimeoutRexmit(const TimeoutResult& result) = 0;
+    virtual void onFlowTotals(const FlowResult& result) = 0;
+    virtual void onPortTotals(const PortResult& result) = 0;
+    virtual void onTotals(const ResultTotals& totals) = 0;
+
+    // return once everything reported so far is out
+    virtual void flush() {}
+};
+
+// results are dropped, e.g. to measure the analysis alone. it has no
+// state, so needs no lock
+class NullResultSink: public ResultSink
+{
+public:
+    void onRoundtrip(const RoundtripResult&) override {}
+    void onTimeoutRexmit(const TimeoutResult&) override {}
+    void onFlowTotals(const FlowResult&) override {}
+    void onPortTotals(const PortResult&) override {}
+    void onTotals(const ResultTotals&) override {}
+};
+
+// the default sink, in the manner of muduo's AsyncLogging: reporters only
+// copy records into the current buffer, a background thread takes the
+// full ones, formats them as text and writes them to |file|. buffers are
+// recycled, so reporters block only on the short append lock
+class AsyncResultWriter: public ResultSink
+{
+public:
+    static const size_t kBufferSize = 1 << 20;
+
+    // |file| is not closed. the writer thread wakes up at least every
+    // |flushInterval| seconds, so results trickle out of a slow capture
+    explicit AsyncResultWriter(FILE* file, int flushInterval = 1);
+    ~AsyncResultWriter() override;
+
+    void onRoundtrip(const RoundtripResult& result) override;
+    void onTimeoutRexmit(const TimeoutResult& result) override;
+    void onFlowTotals(const FlowResult& result) override;
+    void onPortTotals(const PortResult& result) override;
+    void onTotals(const ResultTotals& totals) override;
+    void flush() override;
+
+private:
+    typedef std::vector<char> Buffer;
+    typedef std::unique_ptr<Buffer> BufferPtr;
+
+    void append(uint8_t type, const void* record, size_t len);
+    // move the current buffer to the writer's, with mutex_ held
+    void handOff();
+    void threadFunc();
+
+    FILE* const file_;
+    const int flushInterval_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;      // wakes the writer
+    std::condition_variable flushed_;   // wakes flush()
+    BufferPtr current_;
+    std::vector<BufferPtr> full_;
+    std::vector<BufferPtr> spare_;
+    uint64_t handedOff_;    // buffers given to the writer so far
+    uint64_t written_;      // buffers it wrote so far
+    bool running_;
+    std::thread thread_;
+};
+
+// the sink all analyzers report to. by default an AsyncResultWriter on
+// stdout, started on first use and flushed at exit
+ResultSink& resultSink();
+
+// install |sink|, nullptr restores the default. not thread safe, call it
+// while no flow is analyzed. |sink| must outlive its use
+void setResultSink(ResultSink* sink);
+
+}
+
+#endif //EVA_RESULTSINK_H
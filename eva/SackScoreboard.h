@@ -0,0 +1,92 @@
+//
+// Created by frank on 18-2-9.
+//
+
+#ifndef EVA_SACKSCOREBOARD_H
+#define EVA_SACKSCOREBOARD_H
+
+#include <algorithm>
+#include <vector>
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// sequence ranges above snd_una the receiver has selectively acked,
+// sorted and disjoint. a receiver repeats its newest blocks on every
+// dup ack, so add() reports only the parts of a block that were not
+// sacked before, and the flow looks up just those segments
+class SackScoreboard
+{
+public:
+    struct Range
+    {
+        Sequence left;
+        Sequence right; // exclusive
+    };
+
+    // merge [left, right) and call onNewRange(left, right) for each part
+    // of it that was not sacked yet, in sequence order
+    template <typename Func>
+    void add(Sequence left, Sequence right, Func&& onNewRange)
+    {
+        if (!(left < right))
+            return;
+
+        // the first range that overlaps or touches the block
+        auto first = std::lower_bound(
+                ranges_.begin(), ranges_.end(), left,
+                [](const Range& range, Sequence seq) {
+                    return range.right < seq;
+                });
+
+        Range merged = { left, right };
+        Sequence cursor = left;
+        auto last = first;
+        for (; last != ranges_.end() && last->left <= right; ++last) {
+            if (cursor < last->left)
+                onNewRange(cursor, last->left);
+            if (cursor < last->right)
+                cursor = last->right;
+            if (last->left < merged.left)
+                merged.left = last->left;
+            if (merged.right < last->right)
+                merged.right = last->right;
+        }
+        if (cursor < right)
+            onNewRange(cursor, right);
+
+        if (first == last) {
+            ranges_.insert(first, merged);
+        }
+        else {
+            *first = merged;
+            ranges_.erase(first + 1, last);
+        }
+    }
+
+    // everything below |una| is cumulatively acked
+    void advance(Sequence una)
+    {
+        auto it = ranges_.begin();
+        while (it != ranges_.end() && it->right <= una)
+            ++it;
+        ranges_.erase(ranges_.begin(), it);
+        if (!ranges_.empty() && ranges_.front().left < una)
+            ranges_.front().left = una;
+    }
+
+    void clear() { ranges_.clear(); }
+    bool empty() const { return ranges_.empty(); }
+    size_t rangeCount() const { return ranges_.size(); }
+    size_t capacity() const { return ranges_.capacity(); }
+    const Range& range(size_t i) const { return ranges_[i]; }
+
+private:
+    std::vector<Range> ranges_;
+};
+
+}
+
+#endif //EVA_SACKSCOREBOARD_H
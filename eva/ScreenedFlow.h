@@ -0,0 +1,114 @@
+//
+// Created by frank on 18-2-12.
+//
+
+#ifndef EVA_SCREENEDFLOW_H
+#define EVA_SCREENEDFLOW_H
+
+#include <type_traits>
+
+#include <eva/Analyzer.h>
+#include <eva/ObjectPool.h>
+
+namespace eva
+{
+
+typedef ObjectPool<Analyzer> AnalyzerPool;
+
+// one direction of a flow, analyzed by a Screener while it looks normal.
+// after the unit that makes it look anomalous, a full Analyzer takes
+// over its state and diagnoses the rest of the flow. without |screen|
+// the Analyzer runs from the start. the Screener lives in place, the
+// Analyzer comes from |pool|, which must outlive the flow. the Analyzer
+// adds to |aggregate|
+class ScreenedFlow: noncopyable
+{
+public:
+    template <typename U>
+    ScreenedFlow(const U& unit, bool screen,
+                 ResultAggregate* aggregate, AnalyzerPool* pool)
+            : analyzer_(nullptr),
+              aggregate_(aggregate),
+              pool_(pool),
+              promoted_(false)
+    {
+        if (screen)
+            new (&screenerStorage_) Screener(unit);
+        else
+            analyzer_ = pool_->construct(unit, aggregate_);
+    }
+
+    ~ScreenedFlow()
+    {
+        if (analyzer_ != nullptr)
+            pool_->destroy(analyzer_);
+        else
+            screener()->~Screener();
+    }
+
+    void onDataUnit(const DataUnit& dataUnit)
+    {
+        if (analyzer_ != nullptr) {
+            analyzer_->onDataUnit(dataUnit);
+            return;
+        }
+        screener()->onDataUnit(dataUnit);
+        promoteIfAnomalous();
+    }
+
+    void onAckUnit(const AckUnit& ackUnit)
+    {
+        if (analyzer_ != nullptr) {
+            analyzer_->onAckUnit(ackUnit);
+            return;
+        }
+        screener()->onAckUnit(ackUnit);
+        promoteIfAnomalous();
+    }
+
+    // the Analyzer took over from the Screener
+    bool promoted() const { return promoted_; }
+
+    const InetAddress& srcAddress() const
+    {
+        return analyzer_ != nullptr ? analyzer_->srcAddress()
+                                    : screener()->srcAddress();
+    }
+
+    const InetAddress& dstAddress() const
+    {
+        return analyzer_ != nullptr ? analyzer_->dstAddress()
+                                    : screener()->dstAddress();
+    }
+
+private:
+    // valid until the Analyzer takes over
+    Screener* screener()
+    { return reinterpret_cast<Screener*>(&screenerStorage_); }
+    const Screener* screener() const
+    { return reinterpret_cast<const Screener*>(&screenerStorage_); }
+
+    void promoteIfAnomalous()
+    {
+        Screener* screener = this->screener();
+        if (!screener->anomalous())
+            return;
+        LOG_DEBUG << "[" << screener->roundtripCount() << "]"
+                  << " promoted, limits "
+                  << static_cast<int>(screener->limits());
+        analyzer_ = pool_->construct(std::move(*screener), aggregate_);
+        screener->~Screener();
+        promoted_ = true;
+    }
+
+    std::aligned_storage<sizeof(Screener),
+                         alignof(Screener)>::type screenerStorage_;
+    Analyzer* analyzer_; // nullptr while screening
+    ResultAggregate* aggregate_;
+    AnalyzerPool* pool_;
+    bool promoted_;
+};
+
+}
+
+#endif //EVA_SCREENEDFLOW_H
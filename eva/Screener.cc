@@ -0,0 +1,109 @@
+//
+// Created by frank on 18-2-12.
+//
+
+#include <eva/Screener.h>
+
+using namespace eva;
+
+Screener::Screener(const DataUnit& dat):
+        TcpFlow(dat),
+        bandwidthFilter_(10, 0, 0),
+        rtprop_(-1),
+        rtpropTimestamp_(Timestamp::invalid()),
+        sampleCount_(0),
+        validRttCount_(0),
+        rttTooLongCount_(0),
+        senderLimitedCount_(0),
+        seeReceiverLimited_(false),
+        isSlowStart_(true),
+        limits_(0)
+{}
+
+Screener::Screener(const AckUnit& ack):
+        TcpFlow(ack),
+        bandwidthFilter_(10, 0, 0),
+        rtprop_(-1),
+        rtpropTimestamp_(Timestamp::invalid()),
+        sampleCount_(0),
+        validRttCount_(0),
+        rttTooLongCount_(0),
+        senderLimitedCount_(0),
+        seeReceiverLimited_(false),
+        isSlowStart_(true),
+        limits_(0)
+{}
+
+void Screener::onRateSample(const RateSample& rs, const AckUnit& ackUnit)
+{
+    // the path model is updated as in Analyzer::onRateSample()
+    bool rttIsValid = (!rs.seeRexmit && !ackUnit.u->isSACK()) ||
+                       rs.rtt > rtprop_;
+
+    if (rtprop_ < 0 ||
+        (rttIsValid && rtprop_ > rs.rtt) ||
+        rs.ackReceivedTime - rtpropTimestamp_ >= kRtpropExpiration)
+    {
+        rtprop_ = rs.rtt;
+        rtpropTimestamp_ = rs.ackReceivedTime;
+    }
+
+    bool rttTooLong = (rttIsValid && rs.rtt > rtprop_ * 7 / 5);
+    if (rs.deliveryRate >= bandwidthFilter_.GetBest() ||
+        rttTooLong ||
+        (!rs.isSenderLimited &&
+         !rs.isReceiverLimited)) {
+        bandwidthFilter_.Update(rs.deliveryRate, roundtripCount());
+    }
+
+    sampleCount_++;
+    if (rttIsValid)
+        validRttCount_++;
+    if (rttTooLong)
+        rttTooLongCount_++;
+    if (rs.isReceiverLimited)
+        seeReceiverLimited_ = true;
+    else if (rs.isSenderLimited)
+        senderLimitedCount_++;
+}
+
+void Screener::onNewRoundtrip(Timestamp now,
+                              Timestamp lastAckTime,
+                              int64_t bytesAcked,
+                              int64_t totalAckInterval,
+                              int64_t totalAckCount,
+                              int32_t currFlightSize)
+{
+    // a receiver limited sample decides the round, as it does for the
+    // Analyzer. out of slow start, an rtt mostly inflated is congestion
+    if (seeReceiverLimited_)
+        limits_ |= kReceiverLimited;
+    else if (senderLimitedCount_ * 2 > sampleCount_)
+        limits_ |= kSenderLimited;
+    if (!isSlowStart_ && rttTooLongCount_ * 2 > validRttCount_)
+        limits_ |= kCongestionLimited;
+
+    sampleCount_ = 0;
+    validRttCount_ = 0;
+    rttTooLongCount_ = 0;
+    senderLimitedCount_ = 0;
+    seeReceiverLimited_ = false;
+}
+
+void Screener::onTimeoutRxmit(Timestamp first, Timestamp rexmit)
+{
+    limits_ |= kTimeoutRexmit;
+}
+
+void Screener::onQuitSlowStart(Timestamp when)
+{
+    isSlowStart_ = false;
+    slowStartQuitTime_ = when;
+}
+
+int64_t Screener::bdp() const
+{
+    auto milliseconds = rtprop_ / 1000;
+    auto btlBw = bandwidthFilter_.GetBest();
+    return (milliseconds * btlBw);
+}
@@ -0,0 +1,97 @@
+//
+// Created by frank on 18-2-12.
+//
+
+#ifndef EVA_SCREENER_H
+#define EVA_SCREENER_H
+
+#include <eva/TcpFlow.h>
+#include <eva/Filter.h>
+
+namespace eva
+{
+
+typedef WindowedFilter<
+        int64_t,
+        MaxFilter<int64_t>,
+        uint32_t,
+        uint32_t>
+        MaxBandwidthFilter;
+
+// rtprop is the min rtt of this window
+const int64_t kRtpropExpiration = 30 * Timestamp::kMicroSecondsPerSecond;
+
+// what an Analyzer taking over a screened flow carries over
+struct PathModel
+{
+    MaxBandwidthFilter bandwidthFilter;
+    int64_t   rtprop;
+    Timestamp rtpropTimestamp;
+    Timestamp slowStartQuitTime;
+    bool      isSlowStart;
+};
+
+// a cheap TcpFlow policy that keeps the path model, BtlBw and RTprop,
+// exactly as the Analyzer does, so the flow marks its units the same,
+// and a coarse mask of the limits seen. it does not vote, keeps no
+// flight history and prints nothing. a flow that looks anomalous is
+// handed to a full Analyzer, see ScreenedFlow
+class Screener: public TcpFlow<Screener>
+{
+public:
+    enum Limit
+    {
+        kReceiverLimited   = 1 << 0,
+        kSenderLimited     = 1 << 1,
+        kCongestionLimited = 1 << 2,
+        kTimeoutRexmit     = 1 << 3,
+    };
+
+    static const uint8_t kAnomalous =
+            kReceiverLimited | kCongestionLimited | kTimeoutRexmit;
+
+    explicit Screener(const DataUnit& dat);
+    explicit Screener(const AckUnit& ack);
+
+    void onRateSample(const RateSample& rs, const AckUnit& ackUnit);
+    void onNewRoundtrip(Timestamp now,
+                        Timestamp lastAckTime,
+                        int64_t bytesAcked,
+                        int64_t totalAckInterval,
+                        int64_t totalAckCount,
+                        int32_t currFlightSize);
+    void onTimeoutRxmit(Timestamp first, Timestamp rexmit);
+    void onQuitSlowStart(Timestamp when);
+
+    int64_t bdp() const;
+
+    // the limits of the round trips ended so far
+    uint8_t limits() const { return limits_; }
+    bool anomalous() const { return (limits_ & kAnomalous) != 0; }
+
+    PathModel pathModel() const
+    {
+        return { bandwidthFilter_, rtprop_, rtpropTimestamp_,
+                 slowStartQuitTime_, isSlowStart_ };
+    }
+
+private:
+    MaxBandwidthFilter bandwidthFilter_;
+    int64_t   rtprop_;
+    Timestamp rtpropTimestamp_;
+    Timestamp slowStartQuitTime_;
+
+    // rate samples of the current round trip
+    uint32_t sampleCount_;
+    uint32_t validRttCount_;
+    uint32_t rttTooLongCount_;
+    uint32_t senderLimitedCount_;
+    bool     seeReceiverLimited_;
+
+    bool     isSlowStart_;
+    uint8_t  limits_;
+};
+
+}
+
+#endif //EVA_SCREENER_H
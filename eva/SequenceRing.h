@@ -0,0 +1,150 @@
+//
+// Created by frank on 18-2-9.
+//
+
+#ifndef EVA_SEQUENCERING_H
+#define EVA_SEQUENCERING_H
+
+#include <vector>
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// in flight segments of a flow, kept in sequence order from snd_una.
+// a power of two ring that doubles when full, so appending a segment and
+// releasing a cumulatively acked prefix never allocate once the ring has
+// grown to the flow's largest window. items are addressed by index from
+// the front, and the index of a sequence is found by galloping search.
+// T must have a |sequence| member
+template <typename T>
+class SequenceRing: noncopyable
+{
+public:
+    static const size_t kMinCapacity = 16;
+
+    SequenceRing()
+            : buffer_(kMinCapacity),
+              mask_(kMinCapacity - 1),
+              head_(0),
+              tail_(0)
+    {
+    }
+
+    size_t size() const { return tail_ - head_; }
+    bool empty() const { return head_ == tail_; }
+    size_t capacity() const { return buffer_.size(); }
+
+    T& operator[](size_t i)
+    {
+        assert(i < size());
+        return buffer_[(head_ + i) & mask_];
+    }
+
+    const T& operator[](size_t i) const
+    {
+        assert(i < size());
+        return buffer_[(head_ + i) & mask_];
+    }
+
+    T& front() { return (*this)[0]; }
+    T& back() { return (*this)[size() - 1]; }
+
+    void pushBack(const T& item)
+    {
+        if (size() == buffer_.size())
+            grow();
+        buffer_[tail_ & mask_] = item;
+        tail_++;
+    }
+
+    // release the first |n| items
+    void popFront(size_t n)
+    {
+        assert(n <= size());
+        head_ += n;
+    }
+
+    void clear()
+    {
+        head_ = tail_ = 0;
+    }
+
+    void swap(SequenceRing& other)
+    {
+        buffer_.swap(other.buffer_);
+        std::swap(mask_, other.mask_);
+        std::swap(head_, other.head_);
+        std::swap(tail_, other.tail_);
+    }
+
+    // index of the first item whose sequence is not less than |seq|,
+    // size() if there is none
+    size_t lowerBound(Sequence seq) const
+    {
+        return partitionPoint([seq](const T& item) {
+            return item.sequence < seq;
+        });
+    }
+
+    // index of the first item whose sequence is greater than |seq|,
+    // size() if there is none
+    size_t upperBound(Sequence seq) const
+    {
+        return partitionPoint([seq](const T& item) {
+            return item.sequence <= seq;
+        });
+    }
+
+private:
+    // the first index where pred() turns false. acks and retransmits mostly
+    // land near the front, so gallop from there and binary search the last
+    // step: O(log k) probes for an answer at index k instead of
+    // O(log size()) cold ones
+    template <typename Pred>
+    size_t partitionPoint(Pred pred) const
+    {
+        size_t n = size();
+        size_t first = 0;
+        size_t step = 1;
+        while (first + step <= n && pred((*this)[first + step - 1])) {
+            first += step;
+            step *= 2;
+        }
+
+        size_t count = std::min(step, n - first);
+        while (count > 0) {
+            size_t half = count / 2;
+            if (pred((*this)[first + half])) {
+                first += half + 1;
+                count -= half + 1;
+            }
+            else {
+                count = half;
+            }
+        }
+        return first;
+    }
+
+    void grow()
+    {
+        std::vector<T> buffer(buffer_.size() * 2);
+        size_t n = size();
+        for (size_t i = 0; i < n; i++)
+            buffer[i] = (*this)[i];
+        buffer_.swap(buffer);
+        mask_ = buffer_.size() - 1;
+        head_ = 0;
+        tail_ = n;
+    }
+
+    std::vector<T> buffer_;
+    size_t mask_;
+    size_t head_;
+    size_t tail_;
+};
+
+}
+
+#endif //EVA_SEQUENCERING_H
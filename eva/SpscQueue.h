@@ -0,0 +1,101 @@
+//
+// Created by frank on 18-2-8.
+//
+
+#ifndef EVA_SPSCQUEUE_H
+#define EVA_SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// bounded single producer single consumer ring. items are copied in and
+// out in batches, so one pair of atomic operations moves a whole batch.
+// each side caches the other side's index and only reloads it when the
+// ring looks full (or empty)
+template <typename T>
+class SpscQueue: noncopyable
+{
+public:
+    explicit SpscQueue(size_t capacity)
+            : buffer_(roundUpToPowerOfTwo(capacity)),
+              mask_(buffer_.size() - 1),
+              head_(0),
+              cachedTail_(0),
+              tail_(0),
+              cachedHead_(0)
+    {
+    }
+
+    size_t capacity() const { return buffer_.size(); }
+
+    // any thread, items pushed and not yet popped as of a moment ago
+    size_t size() const
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        // head is read first, so the difference is never negative, but
+        // items pushed in between may make it overshoot
+        return std::min(tail - head, buffer_.size());
+    }
+
+    // producer side, return the number of items pushed
+    size_t push(const T* items, size_t n)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ + n > buffer_.size()) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+        }
+        n = std::min(n, buffer_.size() - (tail - cachedHead_));
+
+        for (size_t i = 0; i < n; i++)
+            buffer_[(tail + i) & mask_] = items[i];
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // consumer side, return the number of items popped
+    size_t pop(T* items, size_t n)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (cachedTail_ - head < n) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+        }
+        n = std::min(n, cachedTail_ - head);
+
+        for (size_t i = 0; i < n; i++)
+            items[i] = buffer_[(head + i) & mask_];
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+private:
+    static size_t roundUpToPowerOfTwo(size_t n)
+    {
+        size_t size = 2;
+        while (size < n)
+            size *= 2;
+        return size;
+    }
+
+    std::vector<T> buffer_;
+    const size_t mask_;
+
+    // consumer and producer indexes on their own cache lines,
+    // together with the consumer's (producer's) copy of the other one
+    char pad0_[64];
+    std::atomic<size_t> head_;
+    size_t cachedTail_;
+    char pad1_[64];
+    std::atomic<size_t> tail_;
+    size_t cachedHead_;
+    char pad2_[64];
+};
+
+}
+
+#endif //EVA_SPSCQUEUE_H
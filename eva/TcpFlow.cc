@@ -5,6 +5,8 @@
 #include <eva/hash.h>
 #include <eva/TcpFlow.h>
 #include <eva/Analyzer.h>
+#include <eva/Screener.h>
+#include <eva/Profile.h>
 #include "Unit.h"
 
 using namespace eva;
@@ -16,7 +18,10 @@ const int64_t   kMinRtt = 1000; // 1ms
 const uint32_t  kMinMss = 536;
 const uint32_t  kMinWsc = 0;
 const uint32_t  kMaxWsc = 7;
-const int       kMaxReordered = 2000;
+// rebase the unit times of a flow when they get older than ~36 minutes,
+// keeping ~18 minutes of history, so 32 bits never overflow
+const int64_t   kMaxTimeOffset = 1LL << 31;
+const int64_t   kRebaseKeep = 1LL << 30;
 
 }
 
@@ -24,62 +29,102 @@ namespace eva
 {
 
 template class TcpFlow<Analyzer>;
+template class TcpFlow<Screener>;
+template TcpFlow<Analyzer>::TcpFlow(TcpFlow<Screener>&& other);
 
 }
 
 template <typename Analyzer>
 TcpFlow<Analyzer>::TcpFlow(const DataUnit& dat):
-        seeMss_(false),
-        seeWsc_(false),
-        mss_(kMinMss),
-        wsc_(kMinWsc),
-        srcAddress_(dat.u->srcAddress),
-        dstAddress_(dat.u->dstAddress),
-        nextSendSequence_(dat.u->dataSequence),
-        ackUnitCount_(0),
-        roundTripCount_(0),
-        prevFlightSize_(0),
-        delivered_(0),
+        epoch_(dat.u->when),
         deliveredTime_(dat.u->when),
         firstSentTime_(dat.u->when),
+        nextSendSequence_(dat.u->dataSequence),
+        delivered_(0),
         pipeSize_(0),
         recvWindow_(0),
+        ackUnitCount_(0),
+        roundTripCount_(0),
+        mss_(kMinMss),
+        wsc_(kMinWsc),
+        seeMss_(false),
+        seeWsc_(false),
+        seeSack_(false),
         isSlowStart_(true),
         isSenderLimited_(false),
-        isReceiverLimited_(false)
+        isReceiverLimited_(false),
+        prevFlightSize_(0),
+        srcAddress_(dat.u->srcAddress()),
+        dstAddress_(dat.u->dstAddress())
 {
     assert(!dat.u->isFIN() && !dat.u->isRST());
 }
 
 template <typename Analyzer>
 TcpFlow<Analyzer>::TcpFlow(const AckUnit& ack):
-        seeMss_(false),
-        seeWsc_(false),
-        mss_(kMinMss),
-        wsc_(kMinWsc),
-        srcAddress_(ack.u->dstAddress), // ack src and dst address should be reversed
-        dstAddress_(ack.u->srcAddress),
-        nextSendSequence_(0),
-        ackUnitCount_(0),
-        roundTripCount_(0),
-        prevFlightSize_(0),
-        delivered_(0),
+        epoch_(ack.u->when),
         deliveredTime_(ack.u->when),
         firstSentTime_(ack.u->when),
+        nextSendSequence_(0),
+        delivered_(0),
         pipeSize_(0),
+        recvWindow_(0),
+        ackUnitCount_(0),
+        roundTripCount_(0),
+        mss_(kMinMss),
+        wsc_(kMinWsc),
+        seeMss_(false),
+        seeWsc_(false),
+        seeSack_(false),
         isSlowStart_(true),
         isSenderLimited_(false),
-        isReceiverLimited_(false)
+        isReceiverLimited_(false),
+        prevFlightSize_(0),
+        srcAddress_(ack.u->dstAddress()), // ack src and dst address should be reversed
+        dstAddress_(ack.u->srcAddress())
 {
     assert(ack.u->isSYN());
 }
 
+template <typename Analyzer>
+template <typename Other>
+TcpFlow<Analyzer>::TcpFlow(TcpFlow<Other>&& other):
+        epoch_(other.epoch_),
+        deliveredTime_(other.deliveredTime_),
+        firstSentTime_(other.firstSentTime_),
+        nextSendSequence_(other.nextSendSequence_),
+        delivered_(other.delivered_),
+        pipeSize_(other.pipeSize_),
+        recvWindow_(other.recvWindow_),
+        ackUnitCount_(other.ackUnitCount_),
+        roundTripCount_(other.roundTripCount_),
+        mss_(other.mss_),
+        wsc_(other.wsc_),
+        seeMss_(other.seeMss_),
+        seeWsc_(other.seeWsc_),
+        seeSack_(other.seeSack_),
+        isSlowStart_(other.isSlowStart_),
+        isSenderLimited_(other.isSenderLimited_),
+        isReceiverLimited_(other.isReceiverLimited_),
+        prevFlightSize_(other.prevFlightSize_),
+        currRoundtrip_(other.currRoundtrip_),
+        srcAddress_(other.srcAddress_),
+        dstAddress_(other.dstAddress_),
+        scoreboard_(std::move(other.scoreboard_)),
+        spuriousRexmits_(other.spuriousRexmits_),
+        reorderedUnits_(other.reorderedUnits_),
+        smallIntervals_(other.smallIntervals_)
+{
+    flow_.swap(other.flow_);
+}
+
 
 template <typename Analyzer>
 void TcpFlow<Analyzer>::onDataUnit(const DataUnit& dataUnit)
 {
-    assert(dataUnit.u->srcAddress == srcAddress_);
-    assert(dataUnit.u->dstAddress == dstAddress_);
+    StageTimer timer(kStageDataUnit);
+    assert(dataUnit.u->srcAddress() == srcAddress());
+    assert(dataUnit.u->dstAddress() == dstAddress());
     assert(dataUnit.u->dataLength > 0 ||
            dataUnit.u->isSYN() ||
            dataUnit.u->isFIN());
@@ -91,6 +136,41 @@ void TcpFlow<Analyzer>::onDataUnit(const DataUnit& dataUnit)
         LOG_INFO << "[" << roundTripCount_ << "]" << " sender FIN";
     }
 
+    auto& u = *dataUnit.u;
+    if (!seeMss_) {
+        // we missed receiver's SYN, continuously estimate the mss from
+        // the units. one longer than an ethernet segment is a super
+        // segment rather than a larger mss
+        mss_ = std::max(mss_, std::min(u.dataLength + u.optionLength,
+                                       kEthernetMss));
+    }
+
+    // only a unit longer than the mss is split
+    uint32_t payload = segmentPayload(mss_, u.optionLength);
+    if (u.dataLength <= payload) {
+        onSegment(dataUnit);
+        return;
+    }
+
+    // a TSO/GRO super segment. analyze the wire segments it stands for,
+    // so pipe, flight size and small unit votes come out as they would
+    // from a capture with offloads disabled
+    Unit segment = u;
+    uint32_t synLength = u.isSYN() ? 1 : 0;
+    for (uint32_t offset = 0; offset < u.dataLength; offset += segment.dataLength) {
+        bool first = offset == 0;
+        bool last = u.dataLength - offset <= payload;
+        segment.dataSequence = u.dataSequence + (first ? 0 : synLength + offset);
+        segment.dataLength = std::min(payload, u.dataLength - offset);
+        segment.flag = static_cast<uint8_t>(u.flag & ~((first ? 0 : TH_SYN) |
+                                                       (last ? 0 : TH_FIN)));
+        onSegment(DataUnit(&segment));
+    }
+}
+
+template <typename Analyzer>
+void TcpFlow<Analyzer>::onSegment(const DataUnit& dataUnit)
+{
     preHandleDataUnit(dataUnit);
 
     bool hasNewData = handleDataUnit(dataUnit);
@@ -112,14 +192,6 @@ void TcpFlow<Analyzer>::preHandleDataUnit(const DataUnit& dataUnit)
     isReceiverLimited_ = (3 * mss_ + pipeSize_ > recvWindow_);
     isSenderLimited_ = (!isReceiverLimited_ &&
                         (smallUnit || pipeNotFull));
-
-    auto dataAndOptionLen = dataUnit.u->dataLength +
-                            dataUnit.u->optionLength;
-    if (!seeMss_ && dataAndOptionLen > mss_) {
-        // continuously estimate max segment size option
-        // if we miss receiver's SYN
-        mss_ = dataAndOptionLen;
-    }
 }
 
 template <typename Analyzer>
@@ -131,22 +203,25 @@ bool TcpFlow<Analyzer>::handleDataUnit(const DataUnit& dataUnit)
     if (pipeSize_ == 0)
         firstSentTime_ = deliveredTime_ = u.when;
 
+    if (u.when - epoch_ > kMaxTimeOffset)
+        rebase(u.when);
+
     // append flow sequence
     P p;
     p.sequence = u.dataSequence;
     p.length = u.dataLength;
     p.delivered = delivered_;
     p.ackUnitCount = ackUnitCount_;
-    p.sentTime = u.when;
-    p.deliveredTime = deliveredTime_;
-    p.firstSentTime = firstSentTime_;
-    p.isSlowStart = isSlowStart_;
-    p.isRexmit = false;
-    p.isSenderLimited = isSenderLimited_;
-    p.isReceiverLimited = isReceiverLimited_;
-    p.isSmallUnit = !u.isSYN() &&
-                    !u.isFIN() &&
-                    u.optionLength + u.dataLength < mss_;
+    p.sentTime = toOffset(u.when);
+    p.deliveredTime = toOffset(deliveredTime_);
+    p.firstSentTime = toOffset(firstSentTime_);
+    p.flags = 0;
+    p.set(P::kSlowStart, isSlowStart_);
+    p.set(P::kSenderLimited, isSenderLimited_);
+    p.set(P::kReceiverLimited, isReceiverLimited_);
+    p.set(P::kSmallUnit, !u.isSYN() &&
+                         !u.isFIN() &&
+                         u.optionLength + u.dataLength < mss_);
 
     if (u.isSYN()) {
         nextSendSequence_ = u.dataSequence;
@@ -160,47 +235,63 @@ bool TcpFlow<Analyzer>::handleDataUnit(const DataUnit& dataUnit)
         LOG_DEBUG << "[" << roundTripCount_ << "]"
                   << " sender retransmit";
 
-        p.isRexmit = true;
+        p.set(P::kRexmit, true);
 
-        int step = 0;
-        auto r = flow_.rbegin();
-        for (; r != flow_.rend(); r++) {
-            if (r->sequence == u.dataSequence) {
-                if (r->ackUnitCount == ackUnitCount_) {
-                    convert().onTimeoutRxmit(r->sentTime, u.when);
+        // the units the retransmit overlaps. a sender that resegments
+        // (TSO, or a smaller mss after a path change) may start it inside
+        // a unit and may cover several
+        Sequence end = u.dataSequence + std::max(u.dataLength, 1u);
+        size_t first = flow_.upperBound(u.dataSequence);
+        if (first > 0 && covers(flow_[first - 1], u.dataSequence))
+            first--;
+        size_t last = flow_.lowerBound(end);
 
-                    // fall back to slow start!!!
-                    isSlowStart_ = true;
-                }
-                *r = p;
-                break;
-            }
-            else if (r->sequence < u.dataSequence) {
-                // spurious rexmit
-                LOG_INFO  << "[" << roundTripCount_ << "]"
-                          << " no matching data unit for rexmit, may be reordered unit. "
-                          << " please run at sender side! ";
-                *r = p;
-                break;
-            }
-            else if (++step >= kMaxReordered) {
+        if (first == last) {
+            if (spuriousRexmits_.shouldLog())
                 LOG_WARN << "[" << roundTripCount_ << "]"
-                         << " sender back up too many steps, give up";
-                break;
-            }
+                         << " spurious rexmit ("
+                         << spuriousRexmits_.count() << " times)";
+            return false;
         }
-        if (r == flow_.rend()) {
-            LOG_WARN << "[" << roundTripCount_ << "]"
-                     << " spurious rexmit";
+
+        if (flow_[first].sequence != u.dataSequence || last - first > 1) {
+            LOG_DEBUG << "[" << roundTripCount_ << "]"
+                      << " rexmit resegmented over " << last - first << " units";
+        }
+
+        bool timeout = flow_[first].ackUnitCount == ackUnitCount_;
+        EVA_TRACE_EVENT(kTraceRexmit, u.when, srcAddress(), dstAddress(),
+                        roundTripCount_, u.dataSequence.seq, timeout);
+        if (timeout) {
+            convert().onTimeoutRxmit(fromOffset(flow_[first].sentTime), u.when);
+
+            // fall back to slow start!!!
+            isSlowStart_ = true;
+        }
+
+        // the units keep their own range and are sent again now. units
+        // the receiver already sacked stay delivered, or their bytes
+        // would count twice
+        for (size_t i = first; i < last; i++) {
+            P& q = flow_[i];
+            if (q.is(P::kDelivered))
+                continue;
+            Sequence sequence = q.sequence;
+            uint32_t length = q.length;
+            q = p;
+            q.sequence = sequence;
+            q.length = length;
         }
         return false;
     }
     else {
-        if (nextSendSequence_ < u.dataSequence) {
+        if (nextSendSequence_ < u.dataSequence &&
+            reorderedUnits_.shouldLog()) {
             LOG_WARN  << "[" << roundTripCount_ << "]"
-                      << " find reordered unit. please run at sender side!";
+                      << " find reordered unit. please run at sender side! ("
+                      << reorderedUnits_.count() << " times)";
         }
-        flow_.push_back(p);
+        flow_.pushBack(p);
         return true;
     }
 }
@@ -223,6 +314,9 @@ void TcpFlow<Analyzer>::postHandleDataUnit(const DataUnit& dataUnit)
         currRoundtrip_.seeSmallUnit = false;
         currRoundtrip_.lastAckTime = Timestamp::invalid();
         currRoundtrip_.deliveryAckCount = 0;
+        EVA_TRACE_EVENT(kTraceRoundtripStart, u.when,
+                        srcAddress(), dstAddress(), roundTripCount_,
+                        u.dataSequence.seq, pipeSize_);
     }
 
     bool smallUnit = !u.isSYN() && !u.isFIN() &&
@@ -236,10 +330,11 @@ void TcpFlow<Analyzer>::postHandleDataUnit(const DataUnit& dataUnit)
 template <typename Analyzer>
 void TcpFlow<Analyzer>::onAckUnit(const AckUnit& ackUnit)
 {
+    StageTimer timer(kStageAckUnit);
     auto& u = *ackUnit.u;
 
-    assert(u.srcAddress == dstAddress_);
-    assert(u.dstAddress == srcAddress_);
+    assert(u.srcAddress() == dstAddress());
+    assert(u.dstAddress() == srcAddress());
     assert(u.isSYN() ||
            u.isACK() ||
            u.isFIN());
@@ -299,51 +394,52 @@ bool TcpFlow<Analyzer>::handleAckUnit(const AckUnit& ackUnit)
     bool ackRexmitData = false;
 
     // a cumulative ack?
-    auto it = flow_.begin();
-    for (; it != flow_.end(); it++) {
-        if (it->sequence < u.ackSequence) {
-            if (it->deliveredTime.valid()) {
-                // ensure this unit was not sacked
-                bytesAcked += it->length;
-                if (it->isRexmit) {
-                    ackRexmitData = true;
-                }
+    size_t acked = flow_.lowerBound(u.ackSequence);
+    for (size_t i = 0; i < acked; i++) {
+        P& p = flow_[i];
+        if (!p.is(P::kDelivered)) {
+            // ensure this unit was not sacked
+            bytesAcked += p.length;
+            if (p.is(P::kRexmit)) {
+                ackRexmitData = true;
             }
         }
-        else
-            break;
     }
 
-    // a selective ack?
-    std::vector<P*> sacked;
-    if (u.sackCount > 0) {
-        sacked.reserve(u.sackCount);
+    // a selective ack? the scoreboard remembers what was sacked before,
+    // so only segments in newly sacked ranges are looked up. a flow that
+    // never saw a SACK block leaves its scoreboard alone
+    size_t sackedCount = 0;
+    if (seeSack_ || u.sackCount > 0) {
+        seeSack_ = true;
+        scoreboard_.advance(u.ackSequence);
+        sacked_.clear();
         for (uint32_t i = 0; i < u.sackCount; i++) {
-            auto &block = u.sackBlock[i];
-            auto start = it;
-            for (; start != flow_.end(); start++) {
-                if (start->sequence >= block.leftEdge) {
-                    if (start->sequence < block.rightEdge) {
-                        if (start->deliveredTime.valid()) {
-                            sacked.push_back(&*start);
-                            bytesAcked += start->length;
-                            if (start->isRexmit) {
-                                ackRexmitData = true;
-                            }
+            auto& block = u.sackBlock[i];
+            Sequence left = std::max(block.leftEdge, u.ackSequence);
+            scoreboard_.add(left, block.rightEdge, [&](Sequence start, Sequence end) {
+                size_t j = std::max(acked, flow_.lowerBound(start));
+                for (; j < flow_.size() && flow_[j].sequence < end; j++) {
+                    P& p = flow_[j];
+                    if (!p.is(P::kDelivered)) {
+                        sacked_.push_back(&p);
+                        bytesAcked += p.length;
+                        if (p.is(P::kRexmit)) {
+                            ackRexmitData = true;
                         }
                     }
-                    else break;
                 }
-            }
-            if (start == flow_.end()) {
-                LOG_DEBUG << "[" << roundTripCount_ << "]"
-                          << " SACK block not found in flow";
-            }
+                if (j == flow_.size()) {
+                    LOG_DEBUG << "[" << roundTripCount_ << "]"
+                              << " SACK block not found in flow";
+                }
+            });
         }
+        sackedCount = sacked_.size();
     }
 
     // not a cumulative or selective ack
-    if (it == flow_.begin() && sacked.empty())
+    if (acked == 0 && sackedCount == 0)
         return false;
 
 //    assert(pipeSize_ >= bytesAcked);
@@ -361,7 +457,10 @@ bool TcpFlow<Analyzer>::handleAckUnit(const AckUnit& ackUnit)
         int64_t totalAckInterval = currRoundtrip_.lastAckTime - currRoundtrip_.firstAckTime;
 
         assert(currRoundtrip_.started);
+        EVA_TRACE_EVENT(kTraceRoundtripEnd, u.when, srcAddress(), dstAddress(),
+                        roundTripCount_, prevFlightSize_, bytesAcked);
         if (roundTripCount_ > 0) {
+            StageTimer roundtripTimer(kStageRoundtrip);
             convert().onNewRoundtrip(u.when,
                                      deliveredTime_,
                                      bytesAcked,
@@ -377,14 +476,14 @@ bool TcpFlow<Analyzer>::handleAckUnit(const AckUnit& ackUnit)
     RateSample rs;
 
     // deal with accumulative acked P
-    std::for_each(flow_.begin(), it, [&](P& p){
-        updateRateSample(p, ackUnit, &rs);
-    });
-    flow_.erase(flow_.begin(), it);
+    for (size_t i = 0; i < acked; i++) {
+        updateRateSample(flow_[i], ackUnit, &rs);
+    }
+    flow_.popFront(acked);
 
     // deal with selective acked P
-    for (auto& p: sacked) {
-        updateRateSample(*p, ackUnit, &rs);
+    for (size_t i = 0; i < sackedCount; i++) {
+        updateRateSample(*sacked_[i], ackUnit, &rs);
     }
 
     if (!rs.priorTime.valid()) {
@@ -398,9 +497,11 @@ bool TcpFlow<Analyzer>::handleAckUnit(const AckUnit& ackUnit)
     rs.seeRexmit = ackRexmitData;
 
     if (rs.interval < kMinRtt) {
-        LOG_ERROR << srcAddress_.toIpPort() << "->"
-                  << dstAddress_.toIpPort()
-                  << " interval too small (" << rs.interval << "us)";
+        if (smallIntervals_.shouldLog())
+            LOG_ERROR << srcAddress().toIpPort() << "->"
+                      << dstAddress().toIpPort()
+                      << " interval too small (" << rs.interval << "us, "
+                      << smallIntervals_.count() << " times)";
         rs.interval = kMinRtt;
     }
 
@@ -428,6 +529,9 @@ bool TcpFlow<Analyzer>::updateRoundtripCount(const AckUnit& ackUnit)
         if (!currRoundtrip_.seeSmallUnit && isSlowStart_) {
             if (currFlightSize < prevFlightSize_ * 3 / 2) {
                 isSlowStart_ = false;
+                EVA_TRACE_EVENT(kTraceQuitSlowStart, ackUnit.u->when,
+                                srcAddress(), dstAddress(), roundTripCount_,
+                                currFlightSize, prevFlightSize_);
                 convert().onQuitSlowStart(firstSentTime_);
                 LOG_DEBUG << "[" << roundTripCount_ << "]"
                           << " quit slow start";
@@ -442,7 +546,7 @@ bool TcpFlow<Analyzer>::updateRoundtripCount(const AckUnit& ackUnit)
 template <typename Analyzer>
 void TcpFlow<Analyzer>::updateRateSample(P& p, const AckUnit& ack, RateSample* rs)
 {
-    if (!p.deliveredTime.valid()) {
+    if (p.is(P::kDelivered)) {
         /* P already SACKed */
         return;
     }
@@ -452,20 +556,23 @@ void TcpFlow<Analyzer>::updateRateSample(P& p, const AckUnit& ack, RateSample* r
 
     // update info using the newest packet
     if (p.delivered >= rs->priorDelivered) {
-        rs->rtt = ack.u->when - p.sentTime;
+        Timestamp sentTime = fromOffset(p.sentTime);
+        Timestamp priorTime = fromOffset(p.deliveredTime);
+
+        rs->rtt = ack.u->when - sentTime;
         if (!rs->dataSentTime.valid()) {
-            rs->dataSentTime = p.sentTime;
+            rs->dataSentTime = sentTime;
         }
         rs->ackReceivedTime = ack.u->when;
         rs->priorDelivered = p.delivered;
-        rs->priorTime = p.deliveredTime;
-        rs->sendElapsed = p.sentTime - p.firstSentTime;
-        rs->ackElapsed = deliveredTime_ - p.deliveredTime;
-        rs->isSenderLimited = p.isSenderLimited;
-        rs->isReceiverLimited = p.isReceiverLimited;
-        if (p.isSmallUnit)
+        rs->priorTime = priorTime;
+        rs->sendElapsed = static_cast<int64_t>(p.sentTime) - p.firstSentTime;
+        rs->ackElapsed = deliveredTime_ - priorTime;
+        rs->isSenderLimited = p.is(P::kSenderLimited);
+        rs->isReceiverLimited = p.is(P::kReceiverLimited);
+        if (p.is(P::kSmallUnit))
             rs->seeSmallUnit = true;
-        firstSentTime_ = p.sentTime;
+        firstSentTime_ = sentTime;
 
         // all timestamp should be valid
         // assert(rs->rtt >= 0);
@@ -478,5 +585,33 @@ void TcpFlow<Analyzer>::updateRateSample(P& p, const AckUnit& ack, RateSample* r
     /* Mark the packet as delivered once it's SACKed to
      * avoid being used again when it's cumulatively acked.
      */
-    p.deliveredTime = Timestamp::invalid();
+    p.set(P::kDelivered, true);
+}
+
+template <typename Analyzer>
+void TcpFlow<Analyzer>::rebase(Timestamp now)
+{
+    Timestamp epoch(now.microSecondsSinceEpoch() - kRebaseKeep);
+    uint32_t delta = toOffset(epoch);
+    auto shift = [delta](uint32_t offset) {
+        // a unit older than the new epoch is clamped to it
+        return offset > delta ? offset - delta : 0;
+    };
+
+    for (size_t i = 0; i < flow_.size(); i++) {
+        P& p = flow_[i];
+        p.sentTime = shift(p.sentTime);
+        p.deliveredTime = shift(p.deliveredTime);
+        p.firstSentTime = shift(p.firstSentTime);
+    }
+    epoch_ = epoch;
+}
+
+template <typename Analyzer>
+size_t TcpFlow<Analyzer>::memoryUsage() const
+{
+    return sizeof(Analyzer) +
+           flow_.capacity() * sizeof(P) +
+           scoreboard_.capacity() * sizeof(SackScoreboard::Range) +
+           sacked_.capacity() * sizeof(P*);
 }
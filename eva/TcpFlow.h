@@ -5,15 +5,67 @@
 #ifndef EVA_TCPFLOW_H
 #define EVA_TCPFLOW_H
 
-#include <deque>
+#include <vector>
 
 #include <eva/Unit.h>
 #include <eva/RateSample.h>
+#include <eva/SequenceRing.h>
+#include <eva/SackScoreboard.h>
+#include <eva/Trace.h>
 #include <eva/util.h>
 
 namespace eva
 {
 
+// one unit in flight. times are microseconds since the flow's epoch and
+// the bools are bits of |flags|, so a unit takes 32 bytes of the ring
+struct InflightUnit
+{
+    enum Flag
+    {
+        kSlowStart        = 1 << 0,
+        kRexmit           = 1 << 1,
+        kSenderLimited    = 1 << 2,
+        kReceiverLimited  = 1 << 3,
+        kSmallUnit        = 1 << 4,
+        kDelivered        = 1 << 5, // cumulatively or selectively acked
+    };
+
+    Sequence   sequence;
+    uint32_t   length;
+    uint32_t   delivered;
+    uint32_t   ackUnitCount;
+    uint32_t   sentTime;
+    uint32_t   deliveredTime;
+    uint32_t   firstSentTime;
+    uint8_t    flags;
+
+    bool is(Flag flag) const { return (flags & flag) != 0; }
+    void set(Flag flag, bool on)
+    {
+        flags = static_cast<uint8_t>(on ? flags | flag : flags & ~flag);
+    }
+};
+static_assert(sizeof(InflightUnit) == 32, "keep the in flight unit 32 bytes");
+
+// the flight between two round trip ends
+struct Roundtrip
+{
+    bool       started = false;
+    Sequence   startSequence;
+    Sequence   endSequence;
+    bool       seeSmallUnit;
+    Timestamp  firstAckTime;
+    Timestamp  lastAckTime;
+    int64_t    deliveryAckCount;
+
+    int32_t flightSize() const
+    {
+        assert(started);
+        return endSequence - startSequence;
+    }
+};
+
 template <typename Analyzer>
 class TcpFlow: noncopyable
 {
@@ -29,47 +81,36 @@ public:
     uint32_t mss()            const { return mss_; }
 
     uint32_t roundtripCount() const { return roundTripCount_; }
+    // bytes cumulatively or selectively acked so far
+    uint32_t delivered()      const { return delivered_; }
+
+    // bytes held by the flow: the analyzer itself and its in flight units
+    size_t memoryUsage() const;
+    size_t inflightCount() const { return flow_.size(); }
+    static size_t unitSize() { return sizeof(P); }
 
     const InetAddress& srcAddress() const { return srcAddress_; }
     const InetAddress& dstAddress() const { return dstAddress_; }
 
+protected:
+    // take over the flow of another policy, e.g. a Screener promoted to
+    // an Analyzer. |other| is left with no units in flight
+    template <typename Other>
+    explicit TcpFlow(TcpFlow<Other>&& other);
+
 private:
-    struct P
-    {
-        Sequence   sequence;
-        uint32_t   length;
-        uint32_t   delivered;
-        uint32_t   ackUnitCount;
-        Timestamp  sentTime;
-        Timestamp  deliveredTime;
-        Timestamp  firstSentTime;
-        bool       isSlowStart;
-        bool       isRexmit;
-        bool       isSenderLimited;
-        bool       isReceiverLimited;
-        bool       isSmallUnit;
-    };
-    std::deque<P> flow_;
+    template <typename Other> friend class TcpFlow;
 
-    struct Roundtrip
+    typedef InflightUnit P;
+
+    // SYN and FIN take one sequence
+    static bool covers(const P& p, Sequence seq)
     {
-        bool       started = false;
-        Sequence   startSequence;
-        Sequence   endSequence;
-        bool       seeSmallUnit;
-        Timestamp  firstAckTime;
-        Timestamp  lastAckTime;
-        int64_t    deliveryAckCount;
-
-        int32_t flightSize() const
-        {
-            assert(started);
-            return endSequence - startSequence;
-        }
-    };
-    Roundtrip currRoundtrip_;
+        return p.sequence <= seq && seq < p.sequence + std::max(p.length, 1u);
+    }
 
 private:
+    void onSegment(const DataUnit& dataUnit);
     void preHandleDataUnit(const DataUnit& dataUnit);
     bool handleDataUnit(const DataUnit& dataUnit);
     void postHandleDataUnit(const DataUnit& dataUnit);
@@ -86,22 +127,23 @@ private:
         return static_cast<Analyzer&>(*this);
     }
 
+    uint32_t toOffset(Timestamp when) const
+    {
+        int64_t offset = when - epoch_;
+        return offset > 0 ? static_cast<uint32_t>(offset) : 0;
+    }
 
-private:
-    bool seeMss_;
-    bool seeWsc_;
-    uint32_t mss_; // peer send mss in SYN
-    uint32_t wsc_; // peer send wsc in SYN
-    const InetAddress srcAddress_;
-    const InetAddress dstAddress_;
+    Timestamp fromOffset(uint32_t offset) const
+    {
+        return Timestamp(epoch_.microSecondsSinceEpoch() + offset);
+    }
 
-    Sequence     nextSendSequence_;
+    void rebase(Timestamp now);
 
-    uint32_t     ackUnitCount_; // number of acks received, including dup ack
-    uint32_t     roundTripCount_;
-    int32_t      prevFlightSize_;
 
-    uint32_t     delivered_;
+private:
+    // touched by every unit
+    Timestamp    epoch_; // time base of the units in flow_
     //The wall clock time when C.delivered was last updated.
     Timestamp    deliveredTime_;
     /*
@@ -110,11 +152,36 @@ private:
      * if the connection was recently idle, then this holds the send time of
      * most recently sent packet.*/
     Timestamp    firstSentTime_;
+    Sequence     nextSendSequence_;
+    uint32_t     delivered_;
     uint32_t     pipeSize_;
     uint32_t     recvWindow_;
+    uint32_t     ackUnitCount_; // number of acks received, including dup ack
+    uint32_t     roundTripCount_;
+    uint32_t     mss_; // peer send mss in SYN
+    uint32_t     wsc_; // peer send wsc in SYN
+    bool         seeMss_;
+    bool         seeWsc_;
+    bool         seeSack_; // the receiver sacked, the scoreboard is in use
     bool         isSlowStart_;
     bool         isSenderLimited_;
     bool         isReceiverLimited_;
+
+    // touched by most units: the ring's indexes and the round trip
+    SequenceRing<P> flow_;
+    int32_t      prevFlightSize_;
+    Roundtrip    currRoundtrip_;
+
+    // for reports and logs
+    const InetAddress srcAddress_;
+    const InetAddress dstAddress_;
+
+    SackScoreboard scoreboard_;
+    std::vector<P*> sacked_; // reused by every ack
+
+    RepeatedWarning spuriousRexmits_;
+    RepeatedWarning reorderedUnits_;
+    RepeatedWarning smallIntervals_;
 };
 
 }
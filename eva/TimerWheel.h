@@ -0,0 +1,154 @@
+//
+// Created by frank on 18-2-10.
+//
+
+#ifndef EVA_TIMERWHEEL_H
+#define EVA_TIMERWHEEL_H
+
+#include <vector>
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// hierarchical timing wheel driven by the caller's clock, which is packet
+// time, so an offline replay expires exactly what a live capture would.
+// level 0 has 256 slots of one tick, each higher level 64 slots of the
+// whole level below. an item is cascaded down a level at most once per
+// level, so schedule() and the work of advance() are O(1) per item, and
+// an advance() that crosses no tick costs a division
+template <typename T>
+class TimerWheel: noncopyable
+{
+public:
+    explicit TimerWheel(int64_t tickUs)
+            : tickUs_(tickUs),
+              currentTick_(-1),
+              size_(0)
+    {
+        assert(tickUs > 0);
+    }
+
+    // fire |item| at the first tick at or after |deadline|
+    void schedule(int64_t deadline, const T& item)
+    {
+        int64_t tick = (deadline + tickUs_ - 1) / tickUs_;
+        if (currentTick_ < 0)
+            currentTick_ = tick - 1;
+        insert(std::max(tick, currentTick_ + 1), item);
+        size_++;
+    }
+
+    // call onExpire(item) for every item due at or before |now|. it may
+    // schedule() again, e.g. a flow that was active since it was armed
+    template <typename Func>
+    void advance(int64_t now, Func&& onExpire)
+    {
+        int64_t tick = now / tickUs_;
+        if (currentTick_ < 0 || size_ == 0) {
+            // nothing to fire, jump
+            currentTick_ = std::max(currentTick_, tick);
+            return;
+        }
+
+        while (currentTick_ < tick && size_ > 0) {
+            currentTick_++;
+            cascade();
+
+            auto& slot = levels_[0][currentTick_ & kLevel0Mask];
+            if (slot.empty())
+                continue;
+
+            // onExpire() may schedule into the wheel while the slot is
+            // walked, so walk a copy and keep both buffers
+            fired_.swap(slot);
+            size_ -= fired_.size();
+            for (auto& entry: fired_)
+                onExpire(entry.item);
+            fired_.clear();
+        }
+        currentTick_ = std::max(currentTick_, tick);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    void clear()
+    {
+        for (auto& level: levels_)
+            for (auto& slot: level)
+                slot.clear();
+        size_ = 0;
+    }
+
+private:
+    static const int kLevel0Bits = 8;
+    static const int kLevelBits = 6;
+    static const int kLevels = 4;
+    static const int64_t kLevel0Mask = (1 << kLevel0Bits) - 1;
+    static const int64_t kLevelMask = (1 << kLevelBits) - 1;
+
+    struct Entry
+    {
+        int64_t tick;
+        T       item;
+    };
+
+    typedef std::vector<Entry> Slot;
+
+    static int shift(int level)
+    {
+        return level == 0 ? 0 : kLevel0Bits + (level - 1) * kLevelBits;
+    }
+
+    void insert(int64_t tick, const T& item)
+    {
+        int64_t delta = tick - currentTick_;
+        int level = 0;
+        while (level < kLevels - 1 && delta >= (1LL << shift(level + 1)))
+            level++;
+
+        // beyond the top level, fire as late as the wheel can
+        int64_t span = 1LL << (shift(kLevels - 1) + kLevelBits);
+        if (delta >= span)
+            tick = currentTick_ + span - 1;
+
+        int64_t mask = level == 0 ? kLevel0Mask : kLevelMask;
+        levels_[level][(tick >> shift(level)) & mask].push_back({tick, item});
+    }
+
+    // when a lower level wraps, spread the next slot of the level above
+    // over the levels below
+    void cascade()
+    {
+        for (int level = 1; level < kLevels; level++) {
+            if ((currentTick_ & ((1LL << shift(level)) - 1)) != 0)
+                break;
+
+            auto& slot = levels_[level][(currentTick_ >> shift(level)) & kLevelMask];
+            if (slot.empty())
+                continue;
+            cascaded_.swap(slot);
+            for (auto& entry: cascaded_)
+                insert(entry.tick, entry.item);
+            cascaded_.clear();
+        }
+    }
+
+    const int64_t tickUs_;
+    int64_t currentTick_;
+    size_t size_;
+    std::vector<Slot> levels_[kLevels] = {
+            std::vector<Slot>(1 << kLevel0Bits),
+            std::vector<Slot>(1 << kLevelBits),
+            std::vector<Slot>(1 << kLevelBits),
+            std::vector<Slot>(1 << kLevelBits),
+    };
+    Slot fired_;
+    Slot cascaded_;
+};
+
+}
+
+#endif //EVA_TIMERWHEEL_H
@@ -0,0 +1,99 @@
+//
+// Created by frank on 18-2-11.
+//
+
+#include <mutex>
+#include <memory>
+#include <signal.h>
+
+#include <eva/Trace.h>
+
+using namespace eva;
+
+namespace
+{
+
+// every ring ever created, never freed
+std::mutex ringsMutex;
+std::vector<std::unique_ptr<TraceRing>> rings;
+
+thread_local TraceRing* localRing = nullptr;
+
+volatile sig_atomic_t dumpRequested = 0;
+
+}
+
+void TraceRing::snapshot(std::vector<TraceEvent>* out) const
+{
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t first = head > kCapacity ? head - kCapacity : 0;
+    size_t begin = out->size();
+    for (size_t i = first; i < head; i++)
+        out->push_back(events_[i & (kCapacity - 1)]);
+
+    // the owner may have lapped the copy, drop what it overwrote. it
+    // writes event |now| before publishing it, over event now - kCapacity
+    std::atomic_thread_fence(std::memory_order_acquire);
+    size_t now = head_.load(std::memory_order_relaxed) + 1;
+    size_t valid = now > kCapacity ? now - kCapacity : 0;
+    if (valid > first) {
+        size_t stale = std::min(valid - first, head - first);
+        out->erase(out->begin() + static_cast<ptrdiff_t>(begin),
+                   out->begin() + static_cast<ptrdiff_t>(begin + stale));
+    }
+}
+
+TraceRing& TraceRing::local()
+{
+    if (localRing == nullptr) {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.emplace_back(new TraceRing);
+        localRing = rings.back().get();
+    }
+    return *localRing;
+}
+
+bool eva::dumpTrace(const char* path)
+{
+#ifdef EVA_TRACE
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        LOG_SYSERR << "fopen " << path;
+        return false;
+    }
+
+    bool ok = true;
+    std::vector<TraceEvent> events;
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    for (auto& ring: rings) {
+        events.clear();
+        ring->snapshot(&events);
+        uint64_t count = events.size();
+        ok = ok && fwrite(&count, sizeof(count), 1, file) == 1;
+        ok = ok && fwrite(events.data(), sizeof(TraceEvent),
+                          events.size(), file) == events.size();
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        LOG_SYSERR << "write " << path;
+    return ok;
+#else
+    LOG_WARN << "tracing is compiled out, build with -DEVA_TRACE";
+    return false;
+#endif
+}
+
+void eva::dumpTraceOnSignal(int signo)
+{
+    if (kTraceEnabled)
+        signal(signo, [](int) { dumpRequested = 1; });
+}
+
+void eva::pollTraceDump(const char* path)
+{
+    if (dumpRequested) {
+        dumpRequested = 0;
+        if (dumpTrace(path))
+            LOG_INFO << "trace dumped to " << path;
+    }
+}
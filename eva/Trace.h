@@ -0,0 +1,137 @@
+//
+// Created by frank on 18-2-11.
+//
+
+#ifndef EVA_TRACE_H
+#define EVA_TRACE_H
+
+#include <atomic>
+#include <vector>
+
+#include <eva/util.h>
+
+namespace eva
+{
+
+// typed events of the analysis, recorded into a binary ring per thread.
+// tracing is compiled in with -DEVA_TRACE (cmake -DEVA_TRACE=ON), without
+// it EVA_TRACE_EVENT() compiles to nothing and its arguments are not
+// evaluated
+enum TraceType
+{
+    kTraceRateSample,       // rtt us, delivery rate kB/s
+    kTraceRoundtripStart,   // start sequence, pipe size
+    kTraceRoundtripEnd,     // flight size, bytes acked
+    kTraceRexmit,           // sequence, 1 if it is a timeout retransmit
+    kTraceQuitSlowStart,    // flight size, previous flight size
+};
+
+// 48 bytes, as dumped
+struct TraceEvent
+{
+    int64_t  when;      // packet time, us since epoch
+    uint32_t srcIP;     // sender of the flow, network order
+    uint32_t dstIP;
+    uint16_t srcPort;
+    uint16_t dstPort;
+    uint32_t roundtrip;
+    uint8_t  type;
+    int64_t  value[2];
+};
+
+static_assert(sizeof(TraceEvent) == 48, "TraceEvent is dumped as is");
+
+// the last kCapacity events of one thread. only the owner thread
+// records, dumps may read it from any thread
+class TraceRing: noncopyable
+{
+public:
+    static const size_t kCapacity = 1 << 14;
+
+    TraceRing(): events_(kCapacity), head_(0) {}
+
+    void record(const TraceEvent& event)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        events_[head & (kCapacity - 1)] = event;
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // append the events still in the ring to |out|, oldest first. events
+    // the owner overwrote while they were copied are left out
+    void snapshot(std::vector<TraceEvent>* out) const;
+
+    // the calling thread's ring, created on first use. rings outlive
+    // their threads, so a dump after the workers joined has their events
+    static TraceRing& local();
+
+private:
+    std::vector<TraceEvent> events_;
+    std::atomic<size_t> head_;
+};
+
+inline void traceEvent(TraceType type, Timestamp when,
+                       const InetAddress& src, const InetAddress& dst,
+                       uint32_t roundtrip, int64_t value0, int64_t value1)
+{
+    TraceEvent event;
+    event.when = when.microSecondsSinceEpoch();
+    event.srcIP = src.ipNetEndian();
+    event.dstIP = dst.ipNetEndian();
+    event.srcPort = src.portNetEndian();
+    event.dstPort = dst.portNetEndian();
+    event.roundtrip = roundtrip;
+    event.type = static_cast<uint8_t>(type);
+    event.value[0] = value0;
+    event.value[1] = value1;
+    TraceRing::local().record(event);
+}
+
+#ifdef EVA_TRACE
+const bool kTraceEnabled = true;
+#else
+const bool kTraceEnabled = false;
+#endif
+
+// write the rings of all threads to |path|: per ring a uint64_t event
+// count, then the events oldest first. any thread may call it while the
+// others record. return false on io error, or if tracing is compiled out
+bool dumpTrace(const char* path);
+
+// on demand dumps: |signo| makes the next pollTraceDump() dump, the
+// handler itself only sets a flag. a no-op when tracing is compiled out
+void dumpTraceOnSignal(int signo);
+void pollTraceDump(const char* path);
+
+#ifdef EVA_TRACE
+#define EVA_TRACE_EVENT(type, when, src, dst, roundtrip, value0, value1) \
+    ::eva::traceEvent(type, when, src, dst, roundtrip, value0, value1)
+#else
+// type checked, never evaluated
+#define EVA_TRACE_EVENT(type, when, src, dst, roundtrip, value0, value1) \
+    static_cast<void>(sizeof(::eva::traceEvent( \
+            type, when, src, dst, roundtrip, value0, value1), 0))
+#endif
+
+// a warning a flow may repeat on every unit is logged on its 1st, 2nd,
+// 4th, 8th... occurrence only, with the count so far
+class RepeatedWarning
+{
+public:
+    RepeatedWarning(): count_(0) {}
+
+    bool shouldLog()
+    {
+        count_++;
+        return (count_ & (count_ - 1)) == 0;
+    }
+
+    uint32_t count() const { return count_; }
+
+private:
+    uint32_t count_;
+};
+
+}
+
+#endif //EVA_TRACE_H
@@ -2,8 +2,10 @@
 // Created by frank on 17-10-25.
 //
 
+#include <algorithm>
+#include <atomic>
+
 #include <eva/Unit.h>
-#include <eva/Exception.h>
 #include <eva/checksum.h>
 #include <eva/hash.h>
 #include "Unit.h"
@@ -13,30 +15,55 @@ using namespace eva;
 namespace
 {
 
-uint32_t unpackLoopback(const unsigned char* data, uint32_t len)
+const char* kUnpackErrorStrings[kNUnpackErrors] = {
+        "ok",
+        "not ipv4 packet",
+        "not tcp segment",
+        "data truncated",
+        "bad ip packet checksum",
+        "bad tcp segment checksum",
+        "too many SACK block",
+};
+
+const char* const kUnpackErrorNames[] = {
+        "ok",
+        "not_ipv4",
+        "not_tcp",
+        "truncated",
+        "bad_ip_checksum",
+        "bad_tcp_checksum",
+        "too_many_sack_blocks",
+};
+
+static_assert(sizeof(kUnpackErrorNames) / sizeof(kUnpackErrorNames[0]) ==
+              kNUnpackErrors, "a name per unpack error");
+
+UnpackError unpackLoopback(const unsigned char* data, uint32_t len,
+                           uint32_t* offset)
 {
     const uint32_t ipv4Family1 = 0x02000000;
     const uint32_t ipv4Family2 = 0x00000002;
-    const uint32_t offset = sizeof(uint32_t);
+    *offset = sizeof(uint32_t);
 
-    if (len < offset)
-        throw Exception("data truncated in loopback frame");
+    if (len < *offset)
+        return kTruncated;
 
     // ipv4 packet only
-    if (memcmp(data, &ipv4Family1, offset) == 0 ||
-        memcmp(data, &ipv4Family2, offset) == 0) {
-        return offset;
+    if (memcmp(data, &ipv4Family1, *offset) == 0 ||
+        memcmp(data, &ipv4Family2, *offset) == 0) {
+        return kUnpackOk;
     }
-    throw Exception("not ipv4 packet");
+    return kNotIpv4;
 }
 
-uint32_t unpackEthernet(const unsigned char* data, uint32_t len)
+UnpackError unpackEthernet(const unsigned char* data, uint32_t len,
+                           uint32_t* offset)
 {
     uint32_t typeOffset = 12;
     uint32_t hdrOffset = 14;
 
     if (len < hdrOffset)
-        return 0;
+        return kTruncated;
 
     // skip IEEE 802.1Q tag
     // see https://en.wikipedia.org/wiki/IEEE_802.1Q
@@ -45,33 +72,36 @@ uint32_t unpackEthernet(const unsigned char* data, uint32_t len)
         typeOffset += 4;
         hdrOffset += 4;
         if (len < hdrOffset)
-            throw Exception("data truncated in ethernet frame");
+            return kTruncated;
     }
 
+    *offset = hdrOffset;
     if (data[typeOffset] == 0x08 && data[typeOffset+1] == 0x00)
-        return hdrOffset;
-    throw Exception("not ipv4 packet");
+        return kUnpackOk;
+    return kNotIpv4;
 }
 
-uint32_t unpackLinuxSll(const unsigned char* data, uint32_t len)
+UnpackError unpackLinuxSll(const unsigned char* data, uint32_t len,
+                           uint32_t* offset)
 {
     const uint32_t typeOffset = 14;
     const uint32_t hdrOffset = 16;
 
     if (len < hdrOffset)
-        throw Exception("data truncated in linux sll frame");
+        return kTruncated;
 
     // ipv4 packet only
+    *offset = hdrOffset;
     if (data[typeOffset] == 0x08 && data[typeOffset+1] == 0x00)
-        return hdrOffset;
-    throw Exception("not ipv4 packet");
+        return kUnpackOk;
+    return kNotIpv4;
 }
 
-uint32_t unpackIP(const unsigned char* data, uint32_t len,
-                  uint32_t* tcpLen, Unit* unit)
+UnpackError unpackIP(const unsigned char* data, uint32_t caplen, uint32_t len,
+                     uint32_t* offset, uint32_t* tcpLen, Unit* unit)
 {
-    if (len < sizeof(struct ip))
-        throw Exception("data truncated in ipv4 header");
+    if (caplen < sizeof(struct ip))
+        return kTruncated;
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wold-style-cast"
@@ -80,119 +110,130 @@ uint32_t unpackIP(const unsigned char* data, uint32_t len,
 
     // ipv4 only
     if (hdr->ip_v != 4)
-        throw Exception("not ipv4 frame");
+        return kNotIpv4;
 
-    const uint32_t hdrOffset = hdr->ip_hl * 4;
+    const uint32_t hdrOffset = hdr->ip_hl * 4u;
 
     // bad length
-    if (len < hdrOffset || hdrOffset < 20)
-        throw Exception("data truncated in ipv4 header");
+    if (caplen < hdrOffset || hdrOffset < 20)
+        return kTruncated;
 
     // totLength != len is a bug
     // since ethernet frame padding bytes
     uint16_t totLength = be16toh(hdr->ip_len);
     if (totLength > len || totLength < hdrOffset)
-        throw Exception("data truncated in ipv4 body");
+        return kTruncated;
 
     // tcp only
     if (hdr->ip_p != IPPROTO_TCP)
-        throw Exception("not tcp segment");
+        return kNotTcp;
 
     // checksum
     if (!ipChecksumValid(hdr))
-        throw Exception("bad ip packet checksum");
+        return kBadIpChecksum;
 
     unit->srcIP = hdr->ip_src.s_addr;
     unit->dstIP = hdr->ip_dst.s_addr;
 
+    *offset = hdrOffset;
     *tcpLen = totLength - hdrOffset;
-    return hdrOffset;
+    return kUnpackOk;
 }
 
-void parseTcpOptions(const unsigned char* data, uint32_t len,
-                     Unit* unit)
+UnpackError parseTcpOptions(const unsigned char* data, uint32_t len,
+                            Unit* unit)
 {
-#define ensure_len(minimal) do { \
-    if (len < (minimal)) \
-        throw Exception("data truncated in tcp option"); \
-} while(false)
-#define update_len(diff) ({data += (diff); len -= (diff);})
-
     unit->optionLength = len;
     unit->sackCount = 0;
     unit->seeMss = false;
     unit->seeWsc = false;
 
     while (len > 0) {
+        uint8_t length;
         switch (data[0]) {
             case TCPOPT_EOL:
-                return;
+                return kUnpackOk;
             case TCPOPT_NOP:
-                update_len(1);
+                length = 1;
                 break;
             case TCPOPT_MAXSEG:
-                ensure_len(TCPOLEN_MAXSEG);
-                memcpy(&unit->mss, data+2, 2);
-                unit->mss = htobe16(unit->mss);
+                length = TCPOLEN_MAXSEG;
+                if (len < length)
+                    return kTruncated;
+                unit->mss = static_cast<uint32_t>(data[2] << 8 | data[3]);
                 unit->seeMss = true;
-                update_len(TCPOLEN_MAXSEG);
                 break;
             case TCPOPT_WINDOW:
-                ensure_len(TCPOLEN_WINDOW);
+                length = TCPOLEN_WINDOW;
+                if (len < length)
+                    return kTruncated;
                 unit->wsc = data[2];
                 unit->seeWsc = true;
-                update_len(TCPOLEN_WINDOW);
                 break;
             case TCPOPT_SACK: {
-                ensure_len(2);
-                uint8_t length = data[1];
-                ensure_len(length);
+                if (len < 2)
+                    return kTruncated;
+                length = data[1];
+                if (len < length || length < 2)
+                    return kTruncated;
 
                 unit->sackCount = (length - 2u) >> 3u;
-                if (unit->sackCount > Unit::kMaxSackCount) {
-                    throw Exception("too many SACK block");
-                }
+                if (unit->sackCount > Unit::kMaxSackCount)
+                    return kTooManySackBlocks;
 
                 for (uint32_t i = 0; i < unit->sackCount; i++) {
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wold-style-cast"
-                    uint32_t leftEdge  = *(uint32_t*)(data + 2 + 8 * i);
-                    uint32_t rightEdge = *(uint32_t*)(data + 2 + 8 * i + 4);
-#pragma GCC diagnostic pop
+                    uint32_t leftEdge, rightEdge;
+                    memcpy(&leftEdge, data + 2 + 8 * i, 4);
+                    memcpy(&rightEdge, data + 2 + 8 * i + 4, 4);
                     auto& block = unit->sackBlock[i];
                     block.leftEdge = be32toh(leftEdge);
                     block.rightEdge = be32toh(rightEdge);
                 }
-
-                update_len(length);
                 break;
             }
             default: {
-                ensure_len(2);
-                uint8_t length = data[1];
-                ensure_len(length);
-                update_len(length);
+                if (len < 2)
+                    return kTruncated;
+                length = data[1];
+                if (len < length || length < 2)
+                    return kTruncated;
                 break;
             }
         }
+        data += length;
+        len -= length;
+    }
+    return kUnpackOk;
+}
+
+bool shouldVerifyTcpChecksum(const struct ip* iphdr, ChecksumMode mode)
+{
+    switch (mode) {
+        case kVerifyChecksum:
+            return true;
+        case kSampleChecksum:
+            // ip id is a cheap, evenly spread sample key
+            return be16toh(iphdr->ip_id) % kChecksumSampleRate == 0;
+        case kTrustChecksum:
+        default:
+            return false;
     }
-#undef ensure_len
-#undef update_len
 }
 
-uint32_t unpackTCP(const unsigned char* data, uint32_t len,
-                   uint32_t prevIpLen, Unit* unit)
+UnpackError unpackTCP(const unsigned char* data, uint32_t caplen, uint32_t len,
+                      uint32_t prevIpLen, uint32_t* offset, Unit* unit,
+                      ChecksumMode checksumMode)
 {
-    if (len < sizeof(struct tcphdr))
-        return 0;
+    if (caplen < sizeof(struct tcphdr))
+        return kTruncated;
 
     auto any = static_cast<const void*>(data);
     auto hdr = static_cast<const struct tcphdr*>(any);
 
     uint32_t optOffset = 20;
-    uint32_t hdrOffset = 4 * hdr->th_off;
-    if (len < hdrOffset || hdrOffset < optOffset)
-        throw Exception("bad header length");
+    uint32_t hdrOffset = 4u * hdr->th_off;
+    if (caplen < hdrOffset || hdrOffset < optOffset)
+        return kTruncated;
 
     unit->srcPort = hdr->th_sport;
     unit->dstPort = hdr->th_dport;
@@ -201,15 +242,22 @@ uint32_t unpackTCP(const unsigned char* data, uint32_t len,
     unit->recvWindow = be16toh(hdr->th_win);
     unit->flag = hdr->th_flags;
 
-    parseTcpOptions(data + optOffset, hdrOffset - optOffset, unit);
+    UnpackError error = parseTcpOptions(data + optOffset,
+                                        hdrOffset - optOffset, unit);
+    if (error != kUnpackOk)
+        return error;
 
-    // tcp checksum
+    // tcp checksum, covers the payload, which a header
+    // only capture does not have
     any = data - prevIpLen;
     auto iphdr = static_cast<const struct ip*>(any);
-    if (!tcpChecksumValid(iphdr ,hdr))
-        throw Exception("bad tcp segment checksum");
+    if (caplen == len &&
+        shouldVerifyTcpChecksum(iphdr, checksumMode) &&
+        !tcpChecksumValid(iphdr ,hdr))
+        return kBadTcpChecksum;
 
-    return hdrOffset;
+    *offset = hdrOffset;
+    return kUnpackOk;
 }
 
 InetAddress createInetAddress(uint32_t ip, uint16_t port)
@@ -224,86 +272,281 @@ InetAddress createInetAddress(uint32_t ip, uint16_t port)
     return InetAddress(addr);
 }
 
-void unpack(int linkType, const unsigned char* data, uint32_t len, Unit* unit)
+typedef UnpackError (*LinkFunction)(const unsigned char* data, uint32_t len,
+                                    uint32_t* offset);
+
+// |unpackLink| is a template argument, so each link type gets its own
+// copy of the whole parse path with the link layer inlined.
+// headers are bounded by |caplen|, lengths come from the ip header, so a
+// frame cut by a small snaplen still gives the right dataLength
+template <LinkFunction unpackLink>
+UnpackError unpackRecord(const PacketRecord& record, Unit* unit,
+                         ChecksumMode checksumMode)
 {
+    const unsigned char* data = record.data;
+    uint32_t caplen = std::min(record.caplen, record.len);
+    uint32_t len = record.len;
     uint32_t offset = 0;
 
-    switch (linkType) {
-        case DLT_NULL:
-        case DLT_LOOP:
-            offset = unpackLoopback(data, len);
-            break;
-        case DLT_EN10MB:
-        case DLT_IEEE802:
-            offset = unpackEthernet(data, len);
-            break;
-        case DLT_LINUX_SLL:
-            offset = unpackLinuxSll(data, len);
-            break;
-        default:
-            fprintf(stderr, "Packet link type not know (%d)! "
-                    "Interpret at Ethernet now - but be carefull!\n", linkType);
-            offset = unpackEthernet(data, len);
-            break;
-    }
+    UnpackError error = unpackLink(data, caplen, &offset);
+    if (error != kUnpackOk)
+        return error;
 
     data += offset;
+    caplen -= offset;
     len -= offset;
 
     uint32_t tcpLen;
-    offset = unpackIP(data, len, &tcpLen, unit);
+    error = unpackIP(data, caplen, len, &offset, &tcpLen, unit);
+    if (error != kUnpackOk)
+        return error;
 
     data += offset;
+    caplen -= offset;
     len = tcpLen; // tcpLen may not equal to (len-offset) because of ethernet frame padding
-    offset = unpackTCP(data, len, offset, unit);
+    error = unpackTCP(data, std::min(caplen, len), len,
+                      offset, &offset, unit, checksumMode);
+    if (error != kUnpackOk)
+        return error;
 
-    data += offset;
     len -= offset;
     unit->dataLength = static_cast<uint16_t>(len);
+    unit->when = Timestamp(record.when);
+    unit->hashCode = generateHashCode(unit->srcIP, unit->dstIP,
+                                      unit->srcPort, unit->dstPort);
+    return kUnpackOk;
+}
+
+template <LinkFunction unpackLink>
+size_t unpackBatchOf(const PacketRecord* records, size_t n, Unit* units,
+                     ChecksumMode checksumMode, UnpackStats* stats)
+{
+    // far enough ahead to hide a cache miss behind a few parses
+    const size_t kPrefetchDistance = 4;
+
+    size_t filled = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + kPrefetchDistance < n) {
+            auto next = records[i + kPrefetchDistance].data;
+            __builtin_prefetch(next);
+            __builtin_prefetch(next + 64);
+        }
+
+        UnpackError error = unpackRecord<unpackLink>(
+                records[i], &units[filled], checksumMode);
+        if (stats != nullptr)
+            stats->add(error);
+        if (error == kUnpackOk)
+            filled++;
+    }
+    return filled;
+}
+
+typedef UnpackError (*RecordFunction)(const PacketRecord& record, Unit* unit,
+                                      ChecksumMode checksumMode);
+typedef size_t (*BatchFunction)(const PacketRecord* records, size_t n,
+                                Unit* units, ChecksumMode checksumMode,
+                                UnpackStats* stats);
+
+struct LinkDispatch
+{
+    RecordFunction unpackRecord;
+    BatchFunction  unpackBatch;
+};
+
+template <LinkFunction unpackLink>
+LinkDispatch makeLinkDispatch()
+{
+    return LinkDispatch{unpackRecord<unpackLink>, unpackBatchOf<unpackLink>};
+}
+
+LinkDispatch getLinkDispatch(int linkType)
+{
+    switch (linkType) {
+        case DLT_NULL:
+        case DLT_LOOP:
+            return makeLinkDispatch<unpackLoopback>();
+        case DLT_EN10MB:
+        case DLT_IEEE802:
+            return makeLinkDispatch<unpackEthernet>();
+        case DLT_LINUX_SLL:
+            return makeLinkDispatch<unpackLinuxSll>();
+        default: {
+            // every batch comes here, warn once
+            static std::atomic<bool> warned(false);
+            if (!warned.exchange(true))
+                fprintf(stderr, "Packet link type not know (%d)! "
+                        "Interpret at Ethernet now - but be carefull!\n",
+                        linkType);
+            return makeLinkDispatch<unpackEthernet>();
+        }
+    }
+}
+
 }
 
 
+namespace eva
+{
+
+const char* unpackErrorString(UnpackError error)
+{
+    return kUnpackErrorStrings[error];
+}
+
+const char* unpackErrorName(UnpackError error)
+{
+    return kUnpackErrorNames[error];
+}
 
-Unit unpackReturnUnit(struct pcap_pkthdr* pkthdr, const unsigned char* data, int linkType)
+void UnpackStats::print(FILE* fp) const
 {
-    Unit u;
+    fprintf(fp, "%lu packets", packets);
+    for (int i = kUnpackOk + 1; i < kNUnpackErrors; i++) {
+        if (drops[i] > 0)
+            fprintf(fp, ", %lu %s", drops[i], kUnpackErrorStrings[i]);
+    }
+    fprintf(fp, "\n");
+}
 
+InetAddress Unit::srcAddress() const
+{
+    return createInetAddress(srcIP, srcPort);
+}
+
+InetAddress Unit::dstAddress() const
+{
+    return createInetAddress(dstIP, dstPort);
+}
+
+UnpackError unpackUnit(const PacketRecord& record,
+                       int linkType,
+                       Unit* u,
+                       ChecksumMode checksumMode)
+{
+    return getLinkDispatch(linkType).unpackRecord(record, u, checksumMode);
+}
+
+UnpackError unpackUnit(const struct pcap_pkthdr* pkthdr,
+                       const unsigned char* data,
+                       int linkType,
+                       Unit* u,
+                       ChecksumMode checksumMode)
+{
     auto seconds = static_cast<int64_t>(pkthdr->ts.tv_sec);
     auto microSeconds = static_cast<int64_t>(pkthdr->ts.tv_usec);
 
-    u.when = Timestamp(seconds * Timestamp::kMicroSecondsPerSecond + microSeconds);
+    PacketRecord record;
+    record.when = seconds * Timestamp::kMicroSecondsPerSecond + microSeconds;
+    record.caplen = pkthdr->caplen;
+    record.len = pkthdr->len;
+    record.data = data;
+
     // pakcet header is OK!
 //    if (pkthdr->caplen < pkthdr->len) {
 //        throw Exception("caplen is less then len");
 //    }
-    unpack(linkType, data, pkthdr->len, &u);
-    u.srcAddress = createInetAddress(u.srcIP, u.srcPort);
-    u.dstAddress = createInetAddress(u.dstIP, u.dstPort);
-    u.hashCode = generateHashCode(u.srcIP, u.dstIP, u.srcPort, u.dstPort);
-    return u;
+    return unpackUnit(record, linkType, u, checksumMode);
 }
 
+size_t unpackBatch(const PacketRecord* records,
+                   size_t n,
+                   int linkType,
+                   Unit* units,
+                   ChecksumMode checksumMode,
+                   UnpackStats* stats)
+{
+    return getLinkDispatch(linkType).unpackBatch(records, n, units,
+                                                 checksumMode, stats);
 }
 
-
-namespace eva
+uint32_t packUnit(const Unit& u, unsigned char* frame)
 {
+    // ethernet, mac addresses are left zero
+    memset(frame, 0, 12);
+    frame[12] = 0x08;
+    frame[13] = 0x00;
+
+    // tcp options
+    unsigned char* opt = frame + 14 + 20 + 20;
+    uint32_t optLen = 0;
+    if (u.seeMss) {
+        opt[optLen++] = TCPOPT_MAXSEG;
+        opt[optLen++] = TCPOLEN_MAXSEG;
+        opt[optLen++] = static_cast<unsigned char>(u.mss >> 8);
+        opt[optLen++] = static_cast<unsigned char>(u.mss);
+    }
+    if (u.seeWsc) {
+        opt[optLen++] = TCPOPT_NOP;
+        opt[optLen++] = TCPOPT_WINDOW;
+        opt[optLen++] = TCPOLEN_WINDOW;
+        opt[optLen++] = static_cast<unsigned char>(u.wsc);
+    }
+    if (u.sackCount > 0) {
+        assert(u.sackCount <= Unit::kMaxSackCount);
+        opt[optLen++] = TCPOPT_NOP;
+        opt[optLen++] = TCPOPT_NOP;
+        opt[optLen++] = TCPOPT_SACK;
+        opt[optLen++] = static_cast<unsigned char>(2 + 8 * u.sackCount);
+        for (uint32_t i = 0; i < u.sackCount; i++) {
+            uint32_t leftEdge = htobe32(u.sackBlock[i].leftEdge.seq);
+            uint32_t rightEdge = htobe32(u.sackBlock[i].rightEdge.seq);
+            memcpy(opt + optLen, &leftEdge, 4);
+            memcpy(opt + optLen + 4, &rightEdge, 4);
+            optLen += 8;
+        }
+    }
+    while (optLen % 4 != 0)
+        opt[optLen++] = TCPOPT_EOL;
+
+    uint32_t tcpHdrLen = 20 + optLen;
+    uint32_t ipLen = 20 + tcpHdrLen + u.dataLength;
+    assert(ipLen <= UINT16_MAX);
+
+    // ipv4
+    void* any = frame + 14;
+    auto iphdr = static_cast<struct ip*>(any);
+    memset(iphdr, 0, 20);
+    iphdr->ip_v = 4;
+    iphdr->ip_hl = 5;
+    iphdr->ip_len = htobe16(static_cast<uint16_t>(ipLen));
+    iphdr->ip_off = htobe16(IP_DF);
+    iphdr->ip_ttl = 64;
+    iphdr->ip_p = IPPROTO_TCP;
+    iphdr->ip_src.s_addr = u.srcIP;
+    iphdr->ip_dst.s_addr = u.dstIP;
+    setIpChecksum(iphdr);
+
+    // tcp
+    any = frame + 14 + 20;
+    auto tcphdr = static_cast<struct tcphdr*>(any);
+    memset(tcphdr, 0, 20);
+    tcphdr->th_sport = u.srcPort;
+    tcphdr->th_dport = u.dstPort;
+    tcphdr->seq = htobe32(u.dataSequence.seq);
+    tcphdr->ack_seq = htobe32(u.ackSequence.seq);
+    tcphdr->th_off = static_cast<uint8_t>(tcpHdrLen / 4) & 0xf;
+    tcphdr->th_flags = u.flag;
+    tcphdr->th_win = htobe16(static_cast<uint16_t>(u.recvWindow));
+    setTcpChecksum(iphdr, tcphdr, tcpHdrLen);
+
+    return 14 + 20 + tcpHdrLen;
+}
 
 bool unpack(struct pcap_pkthdr* pkthdr,
             const unsigned char* data,
             int linkType,
             Unit* u,
-            bool printfError)
+            bool printfError,
+            ChecksumMode checksumMode)
 {
-    try {
-        *u = unpackReturnUnit(pkthdr, data, linkType);
-    }
-    catch (Exception& e) {
+    UnpackError error = unpackUnit(pkthdr, data, linkType, u, checksumMode);
+    if (error != kUnpackOk) {
         if (printfError)
-            LOG_ERROR << "unpack error: " << e.what();
+            LOG_ERROR << "unpack error: " << unpackErrorString(error);
         return false;
     }
     return true;
 }
 
-}
\ No newline at end of file
+}
@@ -13,13 +13,20 @@
 namespace eva
 {
 
+// a captured frame, |data| points into the capture buffer
+struct PacketRecord
+{
+    int64_t              when; // microseconds since epoch
+    uint32_t             caplen;
+    uint32_t             len;
+    const unsigned char* data;
+};
 
-
+// compact parse result of a tcp segment, InetAddress is only materialized
+// by srcAddress()/dstAddress() when a report needs it
 struct Unit
 {
     Timestamp   when;
-    InetAddress srcAddress;
-    InetAddress dstAddress;
     uint32_t    srcIP, dstIP;
     uint16_t    srcPort, dstPort;
     Sequence    dataSequence;
@@ -27,11 +34,11 @@ struct Unit
     uint32_t    recvWindow;
     uint32_t    dataLength;
     uint32_t    optionLength;
+    uint32_t    mss;
+    uint32_t    wsc;
     uint8_t     flag;
     bool        seeMss;
-    uint32_t    mss;
     bool        seeWsc;
-    uint32_t    wsc;
     size_t      hashCode;
 
 
@@ -42,6 +49,9 @@ struct Unit
         Sequence rightEdge;
     } sackBlock[kMaxSackCount];
 
+    InetAddress srcAddress() const;
+    InetAddress dstAddress() const;
+
     bool isSACK() const { return sackCount > 0; }
     bool isFIN()  const { return flag & TH_FIN; }
     bool isSYN()  const { return flag & TH_SYN; }
@@ -51,6 +61,17 @@ struct Unit
     bool isURG()  const { return flag & TH_URG; }
 };
 
+// payload of a full segment on an ethernet path without options
+const uint32_t kEthernetMss = 1500 - 40;
+
+// TSO at the sender and GRO at the receiver hand the capture super
+// segments longer than the mss. on the wire, every segment carries at
+// most |mss| bytes of options and data
+inline uint32_t segmentPayload(uint32_t mss, uint32_t optionLength)
+{
+    return mss > optionLength ? mss - optionLength : mss;
+}
+
 struct DataUnit
 {
     explicit DataUnit(Unit* u_): u(u_) {}
@@ -76,11 +97,86 @@ inline bool operator==(const Unit& lhs, const Unit& rhs)
              lhs.dstPort == rhs.srcPort);
 }
 
+enum ChecksumMode
+{
+    // drop units with bad ip or tcp checksum
+    kVerifyChecksum,
+    // verify tcp checksum of one in kChecksumSampleRate units only
+    kSampleChecksum,
+    // never verify tcp checksum, for captures taken at the sender,
+    // where NIC offload leaves the checksum unset
+    kTrustChecksum,
+};
+
+const uint16_t kChecksumSampleRate = 64;
+
+enum UnpackError
+{
+    kUnpackOk,
+    kNotIpv4,
+    kNotTcp,
+    kTruncated,
+    kBadIpChecksum,
+    kBadTcpChecksum,
+    kTooManySackBlocks,
+    kNUnpackErrors,
+};
+
+const char* unpackErrorString(UnpackError error);
+// a short name, e.g. "bad_tcp_checksum", for labels and metrics
+const char* unpackErrorName(UnpackError error);
+
+// per reason drop counters of a capture
+struct UnpackStats
+{
+    uint64_t packets = 0;
+    uint64_t drops[kNUnpackErrors] = {};
+
+    void add(UnpackError error)
+    {
+        packets++;
+        drops[error]++;
+    }
+
+    uint64_t units() const { return drops[kUnpackOk]; }
+
+    void print(FILE* fp) const;
+};
+
+// parse a captured frame without throwing, |u| is valid only on kUnpackOk
+UnpackError unpackUnit(const PacketRecord& record,
+                       int linkType,
+                       Unit* u,
+                       ChecksumMode checksumMode = kVerifyChecksum);
+
+UnpackError unpackUnit(const struct pcap_pkthdr* pkthdr,
+                       const unsigned char* data,
+                       int linkType,
+                       Unit* u,
+                       ChecksumMode checksumMode = kVerifyChecksum);
+
+// parse |n| records of one capture into |units|, the link layer is
+// dispatched once per batch. frames that fail to parse are counted in
+// |stats| (if not null) and skipped, return the number of units filled
+size_t unpackBatch(const PacketRecord* records,
+                   size_t n,
+                   int linkType,
+                   Unit* units,
+                   ChecksumMode checksumMode = kVerifyChecksum,
+                   UnpackStats* stats = nullptr);
+
+// craft the ethernet/ipv4/tcp headers of |u| into |frame|, the inverse of
+// unpack(). return header length, the frame is (return value + u.dataLength)
+// bytes long and the checksum assumes an all zero payload
+const uint32_t kMaxHeaderLength = 14 + 60 + 60;
+uint32_t packUnit(const Unit& u, unsigned char* frame);
+
 bool unpack(struct pcap_pkthdr* pkthdr,
             const unsigned char* data,
             int linkType,
             Unit* u,
-            bool printfError = false);
+            bool printfError = false,
+            ChecksumMode checksumMode = kVerifyChecksum);
 
 }
 
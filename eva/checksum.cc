@@ -2,22 +2,43 @@
 // Created by frank on 17-10-30.
 //
 
+#include <endian.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #include <eva/checksum.h>
 
 namespace
 {
 
-// cksum - Return 16-bit ones complement of 16-bit ones complement sum
-uint16_t checksum(const void* data, int nbytes)
+// all the sums below add 16-bit words in host byte order into a wide
+// accumulator, the ones complement sum is byte order independent (RFC 1071),
+// so the folded result is swapped to network byte order only once
+
+uint64_t sumScalar(const uint8_t* p, size_t nbytes, uint64_t sum)
 {
-    auto p = static_cast<const uint8_t*>(data);
-    uint64_t sum = 0;
+    while (nbytes >= 8)
+    {
+        /* can't assume pointer alignment :-( */
+        uint64_t w;
+        memcpy(&w, p, 8);
+        sum += (w & 0xffffffff);
+        sum += (w >> 32);
+
+        p += 8;
+        nbytes -= 8;
+    }
 
     while (nbytes >= 2)
     {
-        /* can't assume pointer alignment :-( */
-        sum += (p[0] << 8);
-        sum += p[1];
+        uint16_t w;
+        memcpy(&w, p, 2);
+        sum += w;
 
         p += 2;
         nbytes -= 2;
@@ -26,16 +47,120 @@ uint16_t checksum(const void* data, int nbytes)
     /* special check for odd length */
     if (nbytes == 1)
     {
-        sum += (p[0] << 8);
-        /* lower byte is assumed to be 0 */
+        /* the byte is the high order byte of a zero padded word */
+        sum += be16toh(static_cast<uint16_t>(p[0] << 8));
     }
 
-    sum = (sum >> 16) + (sum & 0xffff);	/* add in carry   */
-    sum += (sum >> 16);		/* maybe one more */
+    return sum;
+}
+
+#if defined(__x86_64__)
+
+uint64_t sumSse2(const uint8_t* p, size_t nbytes)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+
+    // widen each 32-bit lane into a 64-bit lane, so the accumulator
+    // can never overflow within a single packet
+    while (nbytes >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+
+        p += 16;
+        nbytes -= 16;
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    return sumScalar(p, nbytes, lanes[0] + lanes[1]);
+}
+
+__attribute__((target("avx2")))
+uint64_t sumAvx2(const uint8_t* p, size_t nbytes)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    while (nbytes >= 64)
+    {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+
+        p += 64;
+        nbytes -= 64;
+    }
+
+    while (nbytes >= 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
 
+        p += 32;
+        nbytes -= 32;
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes),
+                        _mm256_add_epi64(acc0, acc1));
+    return sumScalar(p, nbytes, lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+#endif
+
+typedef uint64_t (*SumFunc)(const uint8_t* p, size_t nbytes);
+
+#if !defined(__x86_64__)
+
+uint64_t sumGeneric(const uint8_t* p, size_t nbytes)
+{
+    return sumScalar(p, nbytes, 0);
+}
+
+#endif
+
+SumFunc chooseSum()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return sumAvx2;
+    return sumSse2;
+#else
+    return sumGeneric;
+#endif
+}
+
+const SumFunc g_sum = chooseSum();
+
+uint16_t fold(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 16) + (sum & 0xffff);	/* add in carry   */
+    sum = (sum >> 16) + (sum & 0xffff);	/* maybe one more */
     return static_cast<uint16_t>(sum);
 }
 
+// cksum - Return 16-bit ones complement of 16-bit ones complement sum
+uint16_t checksum(const void* data, int nbytes)
+{
+    auto p = static_cast<const uint8_t*>(data);
+    // ip header and short segments are not worth a vector loop
+    uint64_t sum = nbytes < 64 ?
+                   sumScalar(p, static_cast<size_t>(nbytes), 0) :
+                   g_sum(p, static_cast<size_t>(nbytes));
+    return be16toh(fold(sum));
+}
+
 /* compute IP checksum */
 uint16_t ipChecksum(const struct ip* pip)
 {
@@ -44,7 +169,8 @@ uint16_t ipChecksum(const struct ip* pip)
 
 
 /* compute the TCP checksum */
-uint16_t tcpChecksum(const struct ip* pip, const struct tcphdr* ptcp) {
+uint16_t tcpChecksum(const struct ip* pip, const struct tcphdr* ptcp,
+                     uint32_t capturedBytes = UINT32_MAX) {
 
     uint64_t sum = 0;
 
@@ -57,9 +183,8 @@ uint16_t tcpChecksum(const struct ip* pip, const struct tcphdr* ptcp) {
 
     /* quick sanity check, if the packet is fragmented,
        pretend it's valid */
-    if ((ntohs(pip->ip_off) << 2) != 0) {
+    if ((ntohs(pip->ip_off) & (IP_MF | IP_OFFMASK)) != 0) {
         /* both the offset AND the MF bit must be 0 */
-        /* (but we shifted off the DF bit */
         return 0;
     }
 
@@ -71,10 +196,10 @@ uint16_t tcpChecksum(const struct ip* pip, const struct tcphdr* ptcp) {
 
     /* length (TCP header length + TCP data length) */
     uint32_t tcpLength = ntohs(pip->ip_len) - (4 * pip->ip_hl);
-    sum += htons(static_cast<uint16_t>(tcpLength));
+    sum += tcpLength;
 
     /* checksum the TCP header and data */
-    sum += checksum(ptcp, tcpLength);
+    sum += checksum(ptcp, static_cast<int>(std::min(tcpLength, capturedBytes)));
 
     /* roll down into a 16-bit number */
     sum = (sum >> 16) + (sum & 0xffff);
@@ -101,4 +226,17 @@ int tcpChecksumValid (const struct ip* pip, const struct tcphdr* ptcp)
     return sum == 0;
 }
 
-}
\ No newline at end of file
+void setIpChecksum (struct ip* pip)
+{
+    pip->ip_sum = 0;
+    pip->ip_sum = htons(static_cast<uint16_t>(~ipChecksum(pip)));
+}
+
+void setTcpChecksum (const struct ip* pip, struct tcphdr* ptcp,
+                     uint32_t capturedBytes)
+{
+    ptcp->th_sum = 0;
+    ptcp->th_sum = htons(tcpChecksum(pip, ptcp, capturedBytes));
+}
+
+}
@@ -14,6 +14,12 @@ namespace eva
 int ipChecksumValid (const struct ip* pip);
 int tcpChecksumValid (const struct ip* pip, const struct tcphdr* ptcp);
 
+// fill in checksum fields of a crafted packet
+void setIpChecksum (struct ip* pip);
+// tcp payload beyond |capturedBytes| of the segment is taken as zero
+void setTcpChecksum (const struct ip* pip, struct tcphdr* ptcp,
+                     uint32_t capturedBytes);
+
 }
 
 #endif //EVA_CHECKSUM_H
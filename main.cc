@@ -1,81 +1,86 @@
 #include <eva/Analyzer.h>
+#include <eva/ResultSink.h>
 #include <eva/util.h>
+#include <eva/Capture.h>
+#include <eva/PcapFile.h>
 
 int main()
 {
 //    eva::Logger::setLogLevel(eva::Logger::DEBUG);
 
-    char errbuf[PCAP_ERRBUF_SIZE];
-    pcap_t *cap = pcap_open_offline("kernel_buffer_limited/bbr/0.5bdp.pcap", errbuf);
+    eva::PcapFile file("kernel_buffer_limited/bbr/0.5bdp.pcap");
 //    const char* srcAddress = "192.168.1.148";
 //    const char* srcAddress = "192.168.0.100";
     const char* srcAddress = "192.168.0.131";
 
-    if (cap == nullptr) {
-        LOG_ERROR << errbuf;
+    if (!file.valid()) {
+        LOG_ERROR << file.error();
         exit(1);
     }
 
-    int linkType = pcap_datalink(cap);
-    if (linkType == PCAP_ERROR_NOT_ACTIVATED) {
-        LOG_ERROR << errbuf;
+    int linkType = file.linkType();
+
+    uint32_t srcIP;
+    if (!eva::parseIPv4(srcAddress, &srcIP)) {
         exit(1);
     }
 
-    int totalPackets = 0;
-    int invalidPackets = 0;
-
-    struct pcap_pkthdr hdr;
-    const uint8_t* data;
+    const size_t kBatchSize = 64;
+    eva::PacketRecord records[kBatchSize];
+    eva::Unit units[kBatchSize];
+    eva::UnpackStats unpackStats;
 
+    eva::ResultAggregate aggregate;
     eva::Analyzer* analyzer = nullptr;
 
-    while ((data = pcap_next(cap, &hdr)) != nullptr) {
+    bool finished = false;
+    size_t n;
+    while (!finished && (n = file.read(records, kBatchSize)) > 0) {
 
-        totalPackets++;
+        size_t nUnits = eva::unpackBatch(records, n, linkType, units,
+                                         eva::kTrustChecksum, &unpackStats);
+        for (size_t i = 0; i < nUnits && !finished; i++) {
 
-        eva::Unit unit;
-        bool ok = eva::unpack(&hdr, data, linkType, &unit, true);
-        if (!ok) {
-            invalidPackets++;
-            continue;
-        }
+            eva::Unit& unit = units[i];
 
-        if (unit.srcAddress.toIp() == srcAddress)
-        {
-            eva::DataUnit dataUnit(&unit);
-            if (analyzer == nullptr) {
-                if (unit.isSYN() || unit.dataLength > 0) {
-                    analyzer = new eva::Analyzer(dataUnit);
+            if (unit.srcIP == srcIP)
+            {
+                eva::DataUnit dataUnit(&unit);
+                if (analyzer == nullptr) {
+                    if (unit.isSYN() || unit.dataLength > 0) {
+                        analyzer = new eva::Analyzer(dataUnit, &aggregate);
+                        analyzer->onDataUnit(dataUnit);
+                    }
+                }
+                else if (unit.dataLength > 0 || unit.isSYN()) {
                     analyzer->onDataUnit(dataUnit);
                 }
-            }
-            else if (unit.dataLength > 0 || unit.isSYN()) {
-                analyzer->onDataUnit(dataUnit);
-            }
 
 
-            if (unit.isFIN() || unit.isRST()) {
-                break;
-            }
-        }
-        else {
-            eva::AckUnit ackUnit(&unit);
-            if (analyzer == nullptr) {
-                if (unit.isSYN()) {
-                    analyzer = new eva::Analyzer(ackUnit);
-                    analyzer->onAckUnit(ackUnit);
+                if (unit.isFIN() || unit.isRST()) {
+                    finished = true;
                 }
             }
-            else if (!unit.isRST()) {
-                analyzer->onAckUnit(ackUnit);
-            }
             else {
-                break;
+                eva::AckUnit ackUnit(&unit);
+                if (analyzer == nullptr) {
+                    if (unit.isSYN()) {
+                        analyzer = new eva::Analyzer(ackUnit, &aggregate);
+                        analyzer->onAckUnit(ackUnit);
+                    }
+                }
+                else if (!unit.isRST()) {
+                    analyzer->onAckUnit(ackUnit);
+                }
+                else {
+                    finished = true;
+                }
             }
         }
     }
 
     delete analyzer;
-    pcap_close(cap);
+    eva::resultSink().onTotals(aggregate.total());
+    eva::resultSink().flush();
+    unpackStats.print(stderr);
 }
\ No newline at end of file
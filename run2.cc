@@ -6,125 +6,175 @@
 // Created by frank on 18-1-3.
 //
 
-#include <unordered_map>
-#include <memory>
+#include <signal.h>
 
-#include <eva/Analyzer.h>
+#include <eva/Pipeline.h>
+#include <eva/Capture.h>
+#include <eva/Trace.h>
+#include <eva/Metrics.h>
+#include <eva/Profile.h>
 
 using namespace eva;
 
+namespace
+{
+
+void usage()
+{
+    printf("./run srcAddress interface/file "
+           "[verify|sample|trust "
+           "[threads [idleSeconds [simplex|duplex [full|screen "
+           "[metricsPort]]]]]]\n"
+           "checksums are trusted in live capture, verified in files\n");
+    exit(1);
+}
+
+}
+
 int main(int argc, char** argv)
 {
-    if (argc != 3) {
-        printf("./run srcAddress interface/file");
-        exit(1);
+    if (argc < 3 || argc > 9) {
+        usage();
     }
 
     Logger::setLogLevel(Logger::WARN);
 
     const char* srcAddress = argv[1];
     const char* interface = argv[2];
-    const char* file = interface;
 
     printf("%s %s\n", srcAddress, interface);
 
+    uint32_t srcIP;
+    if (!parseIPv4(srcAddress, &srcIP)) {
+        exit(1);
+    }
 
-    char errbuf[PCAP_ERRBUF_SIZE];
-    pcap* cap = pcap_open_live(interface, 65560, 1, 0, errbuf);
-    if (cap == nullptr) {
-        printf("%s\n", errbuf);
-        cap = pcap_open_offline(file, errbuf);
-        if (cap == nullptr) {
-            printf("%s\n", errbuf);
-            exit(1);
-        }
+
+    // live capture is taken at sender side, where checksum offload leaves
+    // tcp checksum unset. the payload is only read to verify the checksum,
+    // so without it capture the headers only. trace files are verified
+    // unless told otherwise, as before
+    bool hasChecksumMode = argc >= 4;
+    ChecksumMode checksumMode = kTrustChecksum;
+    if (hasChecksumMode && !parseChecksumMode(argv[3], &checksumMode)) {
+        exit(1);
     }
 
-    int linkType = pcap_datalink(cap);
-    if (linkType == PCAP_ERROR_NOT_ACTIVATED) {
-        printf("%s\n", errbuf);
+    PacketRingOptions options;
+    options.snaplen = checksumMode == kTrustChecksum ?
+                      kHeaderSnaplen : kFullSnaplen;
+    auto source = openPacketSource(interface, options);
+    if (source == nullptr) {
         exit(1);
     }
+    int linkType = source->linkType();
+    if (!hasChecksumMode && !source->isLive())
+        checksumMode = kVerifyChecksum;
 
-    struct pcap_pkthdr hdr;
-    const uint8_t* data;
-    std::unordered_map<
-            Unit,
-            Analyzer*> flowMap;
+    size_t nThreads = 1;
+    if (argc >= 5 && !parseWorkerCount(argv[4], &nThreads)) {
+        exit(1);
+    }
 
-    bool analyzed = false;
-    int n_packet = 0;
-    int n_flow = 0;
-    while ((data = pcap_next(cap, &hdr)) != nullptr) {
+    // flows silent for this long in packet time are ended
+    FlowTimeouts timeouts;
+    if (argc >= 6 && !parseIdleTimeout(argv[5], &timeouts.idle)) {
+        usage();
+    }
 
-        n_packet++;
+    // duplex also analyzes the data sent back to the source, both
+    // directions of a connection share one flow table lookup
+    bool duplex = false;
+    if (argc >= 7 && !parseDuplexMode(argv[6], &duplex)) {
+        exit(1);
+    }
 
-        eva::Unit unit;
-        bool ok = eva::unpack(&hdr, data, linkType, &unit);
-        if (!ok) {
-            continue;
-        }
+    // screen only diagnoses in full the flows that look anomalous
+    bool screen = false;
+    if (argc >= 8 && !parseScreenMode(argv[7], &screen)) {
+        exit(1);
+    }
 
-        auto it = flowMap.find(unit);
-
-        // data unit
-        if (unit.srcAddress.toIp() == srcAddress)
-        {
-            eva::DataUnit dataUnit(&unit);
-
-            if (it == flowMap.end())
-            {
-                if (unit.isFIN() || unit.isRST()) {
-                    continue;
-                }
-                if (unit.isSYN() || unit.dataLength > 0) {
-                    auto analyzer = new Analyzer(dataUnit);
-                    analyzer->onDataUnit(dataUnit);
-                    flowMap.emplace(unit, analyzer);
-                    n_flow++;
-                }
-            }
-            else if (unit.dataLength > 0 || unit.isSYN())
-            {
-                it->second->onDataUnit(dataUnit);
-            }
-            else if (unit.isFIN() || unit.isRST())
-            {
-                delete it->second;
-                flowMap.erase(it);
-                analyzed = true;
-            }
-        }
-            // ack unit
-        else {
-            eva::AckUnit ackUnit(&unit);
-            if (it == flowMap.end()) {
-                if (unit.isSYN()) {
-                    auto analyzer = new Analyzer(ackUnit);
-                    analyzer->onAckUnit(ackUnit);
-                    flowMap.emplace(unit, analyzer);
-
-                    n_flow++;
-                }
-            }
-            else if (!unit.isRST()) {
-                // unit.isFIN() should input, since sender can still send data
-                it->second->onAckUnit(ackUnit);
-            }
-            else {
-                delete it->second;
-                flowMap.erase(it);
-                analyzed = true;
-            }
-        }
+    // metrics are served only on a given port
+    uint16_t metricsPort = 0;
+    if (argc >= 9 && !parseMetricsPort(argv[8], &metricsPort)) {
+        usage();
     }
-    for (auto& p: flowMap) {
-        delete p.second;
-        analyzed = true;
+
+    char filter[64];
+    snprintf(filter, sizeof(filter), "tcp and host %s", srcAddress);
+    if (!source->setFilter(filter)) {
+        exit(1);
+    }
+
+    const size_t kBatchSize = 64;
+    PacketRecord records[kBatchSize];
+    eva::Unit units[kBatchSize];
+    // any receiver of srcAddress
+    Pipeline pipeline(nThreads, srcIP, 0, timeouts, duplex, screen);
+    UnpackStats unpackStats;
+
+    // counters served in the Prometheus text format on a loopback port
+    CaptureMetrics captureMetrics;
+    std::unique_ptr<MetricsServer> metricsServer;
+    if (metricsPort != 0) {
+        metricsServer.reset(new MetricsServer(metricsPort, pipeline,
+                                              captureMetrics));
+        metricsServer->start();
     }
 
-    if (!analyzed) {
-        printf("0 0 0 0 0 0 0 0    0 0 0 0 0 0 0 0    0 0 0 0 0 0 0 0 \n");
+    // a tracing build dumps its trace rings on kill -USR1 and at the end
+    const char* tracePath = "eva.trace";
+    dumpTraceOnSignal(SIGUSR1);
+
+    // the round trips so far, now and then, while a capture runs
+    const double kSnapshotSeconds = 10;
+    Timestamp lastSnapshot = Timestamp::now();
+
+    for (;;) {
+        StageTimer readTimer(kStageRead);
+        size_t n = source->read(records, kBatchSize);
+        readTimer.stop(n);
+        if (n == 0)
+            break;
+
+        StageTimer unpackTimer(kStageUnpack);
+        size_t nUnits = unpackBatch(records, n, linkType, units,
+                                    checksumMode, &unpackStats);
+        unpackTimer.stop(n);
+        pipeline.dispatch(units, nUnits);
+        if (metricsServer)
+            captureMetrics.publish(unpackStats, source.get());
+        pollTraceDump(tracePath);
+
+        Timestamp now = Timestamp::now();
+        if (timeDifference(now, lastSnapshot) >= kSnapshotSeconds) {
+            lastSnapshot = now;
+            fprintf(stderr, "snapshot: ");
+            pipeline.snapshot().print(stderr);
+        }
     }
-    // printf("%d packets, %d connections\n", n_packet, n_flow);
+
+    pipeline.finish();
+    if (kTraceEnabled)
+        dumpTrace(tracePath);
+    // a profiling build prints where the packet path spent its time
+    if (kProfileEnabled)
+        printProfile(stderr);
+    unpackStats.print(stderr);
+    fprintf(stderr, "%lu flows, %lu expired idle\n",
+            pipeline.flowCount(), pipeline.expiredCount());
+    // the round trips of a screened out flow are in no totals
+    if (screen)
+        fprintf(stderr, "%lu flows promoted to full analysis, "
+                        "%lu screened out\n",
+                pipeline.promotedCount(),
+                pipeline.flowCount() - pipeline.promotedCount());
+
+    CaptureStats captureStats;
+    if (source->captureStats(&captureStats)) {
+        captureStats.print(stderr);
+    }
+
+    // printf("%lu packets, %lu connections\n", unpackStats.packets, pipeline.flowCount());
 }
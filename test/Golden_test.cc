@@ -0,0 +1,159 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <algorithm>
+#include <sstream>
+
+#include <eva/Pipeline.h>
+#include <eva/Capture.h>
+#include <eva/PcapFile.h>
+#include <eva/ResultSink.h>
+
+using namespace eva;
+
+namespace
+{
+
+const size_t kBatchSize = 64;
+
+// analyze the trace at |path| as run does and return what the default
+// sink writes: the round trips, the flow, port and run totals
+std::string replay(const char* path, uint32_t srcIP, size_t nWorkers)
+{
+    FILE* file = tmpfile();
+    if (file == nullptr) {
+        perror("tmpfile");
+        exit(1);
+    }
+
+    {
+        AsyncResultWriter writer(file);
+        setResultSink(&writer);
+
+        // a file, openPacketSource() would try it as an interface first
+        PcapFile source(path);
+        if (!source.valid()) {
+            fprintf(stderr, "%s\n", source.error().c_str());
+            exit(1);
+        }
+        int linkType = source.linkType();
+
+        PacketRecord records[kBatchSize];
+        Unit units[kBatchSize];
+        UnpackStats stats;
+        Pipeline pipeline(nWorkers, srcIP, 0);
+        size_t n;
+        while ((n = source.read(records, kBatchSize)) > 0) {
+            // the fixtures hold headers only, as a capture at the sender
+            size_t nUnits = unpackBatch(records, n, linkType, units,
+                                        kTrustChecksum, &stats);
+            pipeline.dispatch(units, nUnits);
+        }
+        pipeline.finish();
+        setResultSink(nullptr);
+    }
+
+    std::string output;
+    char buf[4096];
+    size_t n;
+    rewind(file);
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        output.append(buf, n);
+    fclose(file);
+    return output;
+}
+
+std::string readFile(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        perror(path);
+        exit(1);
+    }
+    std::string content;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        content.append(buf, n);
+    fclose(file);
+    return content;
+}
+
+std::vector<std::string> splitLines(const std::string& text)
+{
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line))
+        lines.push_back(line);
+    return lines;
+}
+
+// print the first line that differs, return whether none does
+bool compare(const char* what,
+             const std::vector<std::string>& expected,
+             const std::vector<std::string>& actual)
+{
+    size_t n = std::min(expected.size(), actual.size());
+    for (size_t i = 0; i < n; i++) {
+        if (expected[i] != actual[i]) {
+            fprintf(stderr, "%s: line %lu differs\n"
+                            "expected: %s\n"
+                            "actual:   %s\n",
+                    what, i + 1, expected[i].c_str(), actual[i].c_str());
+            return false;
+        }
+    }
+    if (expected.size() != actual.size()) {
+        fprintf(stderr, "%s: %lu lines, expected %lu\n",
+                what, actual.size(), expected.size());
+        return false;
+    }
+    return true;
+}
+
+}
+
+// a golden test: the output on a fixture trace must not change unless
+// the analysis is meant to. one worker must give the expected output
+// line for line. several workers interleave the flows, so their lines
+// are compared as sets
+int main(int argc, char** argv)
+{
+    if (argc != 4) {
+        printf("./golden_test trace.pcap expected.txt srcAddress\n"
+               "with expected.txt \"-\", print the output of one worker\n");
+        exit(1);
+    }
+
+    const char* tracePath = argv[1];
+    const char* expectedPath = argv[2];
+    uint32_t srcIP;
+    if (!parseIPv4(argv[3], &srcIP))
+        exit(1);
+
+    Logger::setLogLevel(Logger::FATAL);
+
+    std::string output = replay(tracePath, srcIP, 1);
+    if (strcmp(expectedPath, "-") == 0) {
+        fwrite(output.data(), 1, output.size(), stdout);
+        return 0;
+    }
+
+    auto expected = splitLines(readFile(expectedPath));
+    bool passed = compare("1 worker", expected, splitLines(output));
+
+    auto sorted = expected;
+    std::sort(sorted.begin(), sorted.end());
+    auto actual = splitLines(replay(tracePath, srcIP, 4));
+    std::sort(actual.begin(), actual.end());
+    passed = compare("4 workers, sorted", sorted, actual) && passed;
+
+    if (!passed) {
+        fprintf(stderr, "%s: output differs from %s\n",
+                tracePath, expectedPath);
+        return 1;
+    }
+    printf("%s: passed\n", tracePath);
+}
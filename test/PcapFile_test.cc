@@ -0,0 +1,191 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <eva/PcapFile.h>
+
+using namespace eva;
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK_EQ(expected, actual) do { \
+    auto e_ = (expected); \
+    auto a_ = (actual); \
+    if (e_ != a_) { \
+        fprintf(stderr, "%s:%d: %s is %ld, expected %ld\n", __FILE__, \
+                __LINE__, #actual, static_cast<long>(a_), \
+                static_cast<long>(e_)); \
+        failures++; \
+    } \
+} while (false)
+
+const uint8_t kBinary = 0x80;
+
+// a pcapng file in host byte order, built block by block
+class PcapngWriter
+{
+public:
+    PcapngWriter()
+    {
+        // section header: byte order magic, version 1.0, unknown length
+        std::string body;
+        put32(&body, 0x1a2b3c4d);
+        put16(&body, 1);
+        put16(&body, 0);
+        put32(&body, 0xffffffff);
+        put32(&body, 0xffffffff);
+        block(0x0a0d0d0a, body);
+    }
+
+    // removes the file save() wrote
+    ~PcapngWriter()
+    {
+        if (!path_.empty())
+            unlink(path_.c_str());
+    }
+
+    // an ethernet interface with an if_tsresol option
+    void interface(uint8_t tsresol)
+    {
+        std::string body;
+        put16(&body, 1);
+        put16(&body, 0);
+        put32(&body, 65535);
+        put16(&body, 9);
+        put16(&body, 1);
+        body.append(1, static_cast<char>(tsresol));
+        body.append(3, '\0');
+        put32(&body, 0);
+        block(0x00000001, body);
+    }
+
+    // an enhanced packet of |length| zero bytes on the first interface
+    void packet(uint64_t ts, uint32_t length)
+    {
+        std::string body;
+        put32(&body, 0);
+        put32(&body, static_cast<uint32_t>(ts >> 32));
+        put32(&body, static_cast<uint32_t>(ts));
+        put32(&body, length);
+        put32(&body, length);
+        body.append((length + 3) & ~3u, '\0');
+        block(0x00000006, body);
+    }
+
+    // write the file and return its path
+    const char* save()
+    {
+        char path[] = "/tmp/pcapfile_test.XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0 || write(fd, file_.data(), file_.size()) !=
+                      static_cast<ssize_t>(file_.size())) {
+            perror("pcapfile_test");
+            exit(1);
+        }
+        close(fd);
+        path_ = path;
+        return path_.c_str();
+    }
+
+private:
+    static void put16(std::string* s, uint16_t x)
+    { s->append(reinterpret_cast<const char*>(&x), sizeof(x)); }
+    static void put32(std::string* s, uint32_t x)
+    { s->append(reinterpret_cast<const char*>(&x), sizeof(x)); }
+
+    void block(uint32_t type, const std::string& body)
+    {
+        auto length = static_cast<uint32_t>(body.size() + 12);
+        put32(&file_, type);
+        put32(&file_, length);
+        file_.append(body);
+        put32(&file_, length);
+    }
+
+    std::string file_;
+    std::string path_;
+};
+
+// the one packet of a file whose only interface has |tsresol|
+int64_t readOne(uint8_t tsresol, uint64_t ts)
+{
+    PcapngWriter w;
+    w.interface(tsresol);
+    w.packet(ts, 60);
+    PcapFile file(w.save());
+    CHECK_EQ(true, file.valid());
+    PacketRecord record = PacketRecord();
+    CHECK_EQ(1u, file.read(&record, 1));
+    CHECK_EQ(60u, record.caplen);
+    return record.when;
+}
+
+bool validWith(uint8_t tsresol)
+{
+    PcapngWriter w;
+    w.interface(tsresol);
+    w.packet(0, 60);
+    PcapFile file(w.save());
+    return file.valid();
+}
+
+void testResolution()
+{
+    CHECK_EQ(1500000000123456LL, readOne(9, 1500000000123456789ULL));
+    CHECK_EQ(1500000000123456LL, readOne(6, 1500000000123456ULL));
+    CHECK_EQ(1500000000000000LL, readOne(0, 1500000000ULL));
+    // 5.5 seconds in units of 2^-20 second
+    CHECK_EQ(5500000LL, readOne(kBinary | 20, 11ULL << 19));
+    CHECK_EQ(1000000LL, readOne(19, 10000000000000000000ULL));
+    CHECK_EQ(1000000LL, readOne(kBinary | 44, 1ULL << 44));
+}
+
+// an exponent that would overflow the conversion makes the file invalid
+void testBadResolution()
+{
+    CHECK_EQ(false, validWith(20));
+    CHECK_EQ(false, validWith(26));
+    CHECK_EQ(false, validWith(127));
+    CHECK_EQ(false, validWith(kBinary | 45));
+    CHECK_EQ(false, validWith(kBinary | 64));
+}
+
+// past the first interface, a bad one ends the file
+void testBadResolutionLater()
+{
+    PcapngWriter w;
+    w.interface(6);
+    w.packet(1, 60);
+    w.interface(26);
+    w.packet(2, 60);
+    PcapFile file(w.save());
+    CHECK_EQ(true, file.valid());
+    PacketRecord records[2];
+    CHECK_EQ(1u, file.read(records, 2));
+    CHECK_EQ(1LL, records[0].when);
+}
+
+}
+
+int main()
+{
+    Logger::setLogLevel(Logger::FATAL);
+
+    testResolution();
+    testBadResolution();
+    testBadResolutionLater();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+}
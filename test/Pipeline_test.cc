@@ -0,0 +1,104 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <eva/Pipeline.h>
+#include <eva/ResultSink.h>
+#include <eva/hash.h>
+
+using namespace eva;
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK_EQ(expected, actual) do { \
+    auto e_ = (expected); \
+    auto a_ = (actual); \
+    if (e_ != a_) { \
+        fprintf(stderr, "%s:%d: %s is %ld, expected %ld\n", __FILE__, \
+                __LINE__, #actual, static_cast<long>(a_), \
+                static_cast<long>(e_)); \
+        failures++; \
+    } \
+} while (false)
+
+const uint32_t kSenderIP = 0x0100000a; // 10.0.0.1 in network order
+const uint32_t kReceiverIP = 0x0200000a;
+const int64_t  kSecond = Timestamp::kMicroSecondsPerSecond;
+const int64_t  kStart = 1500000000LL * kSecond;
+
+Unit makeData(int64_t when, uint16_t port, uint32_t sequence)
+{
+    Unit u = Unit();
+    u.when = Timestamp(when);
+    u.srcIP = kSenderIP;
+    u.dstIP = kReceiverIP;
+    u.srcPort = htobe16(80);
+    u.dstPort = htobe16(port);
+    u.dataSequence = sequence;
+    u.dataLength = 1460;
+    u.recvWindow = 65535;
+    u.flag = TH_ACK;
+    u.hashCode = generateHashCode(u.srcIP, u.dstIP, u.srcPort, u.dstPort);
+    return u;
+}
+
+// a port whose flow lands on another worker than |port|'s, if there is
+// another one
+uint16_t portOnOtherShard(uint16_t port, size_t nWorkers)
+{
+    size_t shard = makeData(0, port, 0).hashCode % nWorkers;
+    for (uint16_t other = static_cast<uint16_t>(port + 1); ; other++) {
+        if (nWorkers == 1 ||
+            makeData(0, other, 0).hashCode % nWorkers != shard)
+            return other;
+    }
+}
+
+// one flow sends once and goes silent, while a flow on the other worker
+// keeps sending for a minute of packet time. the silent flow's worker
+// gets no unit of its own after the first, it must still expire it
+void testSilentShard(size_t nWorkers)
+{
+    FlowTimeouts timeouts;
+    timeouts.idle = 10 * kSecond;
+    timeouts.halfOpen = 10 * kSecond;
+    Pipeline pipeline(nWorkers, kSenderIP, 0, timeouts);
+
+    const uint16_t kSilentPort = 10000;
+    const uint16_t busyPort = portOnOtherShard(kSilentPort, nWorkers);
+
+    Unit first = makeData(kStart, kSilentPort, 1);
+    pipeline.dispatch(&first, 1);
+    uint32_t sequence = 1;
+    for (int64_t t = 0; t < 60 * kSecond; t += kSecond / 2) {
+        Unit u = makeData(kStart + t, busyPort, sequence);
+        pipeline.dispatch(&u, 1);
+        sequence += u.dataLength;
+    }
+    pipeline.finish();
+
+    CHECK_EQ(2u, pipeline.flowCount());
+    CHECK_EQ(1u, pipeline.expiredCount());
+}
+
+}
+
+int main()
+{
+    Logger::setLogLevel(Logger::FATAL);
+    NullResultSink nullSink;
+    setResultSink(&nullSink);
+
+    testSilentShard(1);
+    testSilentShard(2);
+    testSilentShard(4);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+}
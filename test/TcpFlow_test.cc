@@ -0,0 +1,205 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <eva/Analyzer.h>
+#include <eva/ResultSink.h>
+
+using namespace eva;
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK_EQ(expected, actual) do { \
+    auto e_ = (expected); \
+    auto a_ = (actual); \
+    if (e_ != a_) { \
+        fprintf(stderr, "%s:%d: %s is %ld, expected %ld\n", __FILE__, \
+                __LINE__, #actual, static_cast<long>(a_), \
+                static_cast<long>(e_)); \
+        failures++; \
+    } \
+} while (false)
+
+const uint32_t kMss = 1460;
+const int64_t  kRtt = 50 * 1000;
+// timestamps option
+const uint32_t kOptionLength = 12;
+
+class Connection
+{
+public:
+    // without |handshake| the capture starts mid-stream, the analyzer
+    // is created by the first data unit and never sees the mss option
+    explicit Connection(bool handshake = true)
+            : now_(1500000000LL * Timestamp::kMicroSecondsPerSecond),
+              isn_(1000),
+              optionLength_(handshake ? 0 : kOptionLength)
+    {
+        if (!handshake)
+            return;
+
+        Unit syn = data(TH_SYN, isn_, 0);
+        analyzer_.reset(new Analyzer(DataUnit(&syn)));
+        analyzer_->onDataUnit(DataUnit(&syn));
+
+        now_ += kRtt;
+        Unit synAck = ack(isn_ + 1);
+        synAck.flag = TH_SYN | TH_ACK;
+        synAck.seeMss = true;
+        synAck.mss = kMss;
+        synAck.seeWsc = true;
+        synAck.wsc = 7;
+        analyzer_->onAckUnit(AckUnit(&synAck));
+    }
+
+    // sequence of the |i|th byte of payload
+    uint32_t seq(uint32_t i) const { return isn_ + 1 + i; }
+
+    void send(uint32_t offset, uint32_t length)
+    {
+        now_ += 10;
+        Unit u = data(TH_ACK, seq(offset), length);
+        if (analyzer_ == nullptr)
+            analyzer_.reset(new Analyzer(DataUnit(&u)));
+        analyzer_->onDataUnit(DataUnit(&u));
+    }
+
+    // cumulative ack of |offset|, sacking [left, right) if right > left
+    void receive(uint32_t offset, uint32_t left = 0, uint32_t right = 0)
+    {
+        now_ += 10;
+        Unit u = ack(seq(offset));
+        if (right > left) {
+            u.sackCount = 1;
+            u.sackBlock[0].leftEdge = seq(left);
+            u.sackBlock[0].rightEdge = seq(right);
+        }
+        analyzer_->onAckUnit(AckUnit(&u));
+    }
+
+    void wait(int64_t us) { now_ += us; }
+
+    const Analyzer& analyzer() const { return *analyzer_; }
+
+private:
+    Unit base() const
+    {
+        Unit u = Unit();
+        u.when = Timestamp(now_);
+        u.srcIP = 0x0100000a;
+        u.dstIP = 0x0200000a;
+        u.srcPort = htobe16(80);
+        u.dstPort = htobe16(10000);
+        u.recvWindow = 65535;
+        return u;
+    }
+
+    Unit data(uint8_t flag, uint32_t sequence, uint32_t length) const
+    {
+        Unit u = base();
+        u.flag = flag;
+        u.dataSequence = sequence;
+        u.dataLength = length;
+        u.optionLength = flag & TH_SYN ? 0 : optionLength_;
+        return u;
+    }
+
+    Unit ack(uint32_t sequence) const
+    {
+        Unit u = base();
+        std::swap(u.srcIP, u.dstIP);
+        std::swap(u.srcPort, u.dstPort);
+        u.flag = TH_ACK;
+        u.ackSequence = sequence;
+        return u;
+    }
+
+    int64_t now_;
+    uint32_t isn_;
+    uint32_t optionLength_;
+    std::unique_ptr<Analyzer> analyzer_;
+};
+
+// every byte is delivered once, however the acks come
+void testInOrder()
+{
+    Connection c;
+    for (uint32_t i = 0; i < 4; i++)
+        c.send(i * kMss, kMss);
+    c.wait(kRtt);
+    for (uint32_t i = 1; i <= 4; i++)
+        c.receive(i * kMss);
+    CHECK_EQ(4 * kMss, c.analyzer().delivered());
+}
+
+// the first segment is lost, the next two are sacked. the sender
+// retransmits the hole and the sacked segments as one super segment, as
+// TSO may. the sacked bytes must not be delivered a second time
+void testRexmitOverSacked()
+{
+    Connection c;
+    for (uint32_t i = 0; i < 4; i++)
+        c.send(i * kMss, kMss);
+    c.wait(kRtt);
+    c.receive(0, kMss, 2 * kMss);
+    c.receive(0, kMss, 3 * kMss);
+    CHECK_EQ(2 * kMss, c.analyzer().delivered());
+
+    c.send(0, 3 * kMss);
+    c.wait(kRtt);
+    c.receive(4 * kMss);
+    CHECK_EQ(4 * kMss, c.analyzer().delivered());
+}
+
+// a retransmit of sacked segments only adds nothing
+void testRexmitOfSackedOnly()
+{
+    Connection c;
+    for (uint32_t i = 0; i < 3; i++)
+        c.send(i * kMss, kMss);
+    c.wait(kRtt);
+    c.receive(0, kMss, 3 * kMss);
+    c.send(kMss, 2 * kMss);
+    c.wait(kRtt);
+    c.receive(3 * kMss);
+    CHECK_EQ(3 * kMss, c.analyzer().delivered());
+}
+
+// the SYN was missed, full size segments carrying timestamps give an
+// mss of 1460 and are not split, a super segment still is
+void testMidStreamMss()
+{
+    Connection c(false);
+    uint32_t payload = kMss - kOptionLength;
+    for (uint32_t i = 0; i < 10; i++)
+        c.send(i * payload, payload);
+    CHECK_EQ(kMss, c.analyzer().mss());
+    CHECK_EQ(10u, c.analyzer().inflightCount());
+
+    c.send(10 * payload, 3 * payload);
+    CHECK_EQ(kMss, c.analyzer().mss());
+    CHECK_EQ(13u, c.analyzer().inflightCount());
+}
+
+}
+
+int main()
+{
+    Logger::setLogLevel(Logger::FATAL);
+    NullResultSink nullSink;
+    setResultSink(&nullSink);
+
+    testInOrder();
+    testRexmitOverSacked();
+    testRexmitOfSackedOnly();
+    testMidStreamMss();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+}
@@ -0,0 +1,26 @@
+#!/bin/sh
+
+# remake the golden fixtures: synthesize each trace, then record the
+# output of its analysis as the expected output. review the diff of the
+# expected output before committing it
+#
+#   test/golden/generate.sh ../eva-bin/bin
+
+set -e
+
+BIN_DIR=${1:?usage: $0 bin_dir}
+GOLDEN_DIR=`dirname $0`
+
+fixture() {
+    name=$1
+    shift
+    $BIN_DIR/trace_synthesizer "$@" $GOLDEN_DIR/$name.pcap
+    $BIN_DIR/golden_test $GOLDEN_DIR/$name.pcap - 10.0.0.1 \
+        > $GOLDEN_DIR/$name.txt
+}
+
+fixture bulk            -n 3 -c 3 -B 10 -b 400000 -l 0.01
+fixture receiver_window -n 2 -c 2 -w 65535 -b 400000
+fixture application     -n 2 -c 2 -a 20 -b 30000
+fixture bufferbloat     -n 1 -c 1 -B 10 -q 4000000 -l 0 -r 20 -b 1000000
+fixture loss_no_sack    -n 2 -c 2 -B 10 -l 0.03 -k -b 500000
@@ -0,0 +1,666 @@
+//
+// Created by frank on 18-2-14.
+//
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <queue>
+#include <random>
+
+#include <eva/Unit.h>
+#include <eva/ResultSink.h>
+
+using namespace eva;
+
+// offline synthetic traces for scale tests: many bulk senders, each on its
+// own path, modeled one round trip at a time, written straight to a pcap
+// file with the label the model gives every round trip. frames carry the
+// headers only, as a capture with a short snaplen at the sender would
+
+namespace
+{
+
+const uint32_t kMss = kEthernetMss;
+const uint32_t kInitialWindow = 10;
+const uint32_t kNoLoss = UINT32_MAX;
+const uint32_t kPortsPerAddress = 50000;
+const int64_t kNanosPerSecond = 1000000000;
+// trace time starts at 2017-07-14 02:40:00 UTC
+const int64_t kEpoch = 1500000000 * kNanosPerSecond;
+
+struct Options
+{
+    uint64_t flows = 1000;
+    uint32_t concurrent = 100;
+    uint64_t flowBytes = 1 << 20;
+    double   rttMs = 50;
+    double   bottleneckMbps = 100;
+    uint32_t queueBytes = 256 << 10;
+    uint32_t rwnd = 4 << 20;
+    uint32_t sndbuf = 4 << 20;
+    double   appKBps = 0;
+    double   lossRate = 0.0001;
+    bool     sack = true;
+    uint64_t seed = 1;
+    const char* labelPath = nullptr;
+};
+
+// pcap with microsecond timestamps, ethernet frames
+class PcapWriter: noncopyable
+{
+public:
+    explicit PcapWriter(const char* path)
+            : fp_(fopen(path, "wb")),
+              buffer_(1 << 20)
+    {
+        if (fp_ == nullptr) {
+            perror(path);
+            exit(1);
+        }
+        setvbuf(fp_, buffer_.data(), _IOFBF, buffer_.size());
+        const uint32_t header[6] = {
+                0xa1b2c3d4, 2 | (4 << 16), 0, 0, 65535, 1
+        };
+        write(header, sizeof(header));
+    }
+
+    ~PcapWriter()
+    {
+        if (fclose(fp_) != 0)
+            perror("fclose");
+    }
+
+    void append(int64_t ns, const unsigned char* frame,
+                uint32_t caplen, uint32_t len)
+    {
+        const uint32_t header[4] = {
+                static_cast<uint32_t>(ns / kNanosPerSecond),
+                static_cast<uint32_t>(ns % kNanosPerSecond / 1000),
+                caplen,
+                len,
+        };
+        write(header, sizeof(header));
+        write(frame, caplen);
+    }
+
+private:
+    void write(const void* data, size_t n)
+    {
+        if (fwrite(data, 1, n, fp_) != n) {
+            perror("fwrite");
+            exit(1);
+        }
+    }
+
+    FILE* fp_;
+    std::vector<char> buffer_;
+};
+
+// the segments one window sends back to back. its acks come back during
+// the next round, spaced as the data left the bottleneck
+struct Round
+{
+    int64_t  start = 0;       // ns, the first ack of the round before
+    uint32_t seq = 0;         // the first new byte
+    uint32_t bytes = 0;       // new bytes
+    uint32_t segments = 0;    // the retransmission included
+    uint32_t lost = kNoLoss;  // the segment dropped at the bottleneck
+    bool     rexmit = false;  // the first segment fills the hole of the
+                              // round before
+    uint32_t rexmitSeq = 0;
+    uint32_t rexmitLength = 0;
+
+    // [begin, end) of new data segment |i|, retransmission excluded
+    uint32_t segmentBegin(uint32_t i) const
+    {
+        return seq + (i - rexmit) * kMss;
+    }
+
+    uint32_t segmentEnd(uint32_t i) const
+    {
+        return seq + std::min((i - rexmit + 1) * kMss, bytes);
+    }
+};
+
+enum Phase : uint8_t
+{
+    kHandshake,
+    kData,
+    kClosing,
+    kDone,
+};
+
+struct Flow
+{
+    uint32_t id;
+    Phase    phase;
+    uint8_t  step;          // units sent in the handshake or the close
+    uint8_t  wsc;
+    bool     cwndLimited;
+    int64_t  start;         // ns, the syn, then the fin
+    int64_t  rtprop;        // ns
+    int64_t  spacing;       // ns a full segment takes at the bottleneck
+    uint64_t sent;          // new bytes sent
+    uint64_t total;         // bytes the application writes
+    uint32_t isn;
+    uint32_t cwnd;          // segments
+    uint32_t ssthresh;
+    uint32_t roundtrip;
+    int64_t  nextRound;     // ns
+    uint32_t dataIndex;     // next segment of |data|
+    uint32_t ackIndex;      // next ack of |acks|
+    Round    data;          // being sent
+    Round    acks;          // being acked
+};
+
+class Synthesizer: noncopyable
+{
+public:
+    Synthesizer(const Options& options, const char* pcapPath)
+            : options_(options),
+              pcap_(pcapPath),
+              labels_(nullptr),
+              gen_(options.seed),
+              flows_(std::min<uint64_t>(options.concurrent, options.flows)),
+              started_(0),
+              packets_(0),
+              bytes_(0),
+              lastTime_(kEpoch)
+    {
+        if (options.labelPath != nullptr) {
+            labels_ = fopen(options.labelPath, "w");
+            if (labels_ == nullptr) {
+                perror(options.labelPath);
+                exit(1);
+            }
+            fprintf(labels_, "# receiver roundtrip start_us end_us "
+                             "limit segments\n");
+        }
+        senderIP_ = htobe32(0x0a000001);
+        senderPort_ = htobe16(80);
+        // the smallest scale that fits the receive window in 16 bits
+        wsc_ = 0;
+        while (wsc_ < 14 && (options.rwnd >> wsc_) > UINT16_MAX)
+            wsc_++;
+    }
+
+    ~Synthesizer()
+    {
+        if (labels_ != nullptr)
+            fclose(labels_);
+    }
+
+    void run()
+    {
+        auto rtt = static_cast<int64_t>(options_.rttMs * 1e6);
+        for (uint32_t slot = 0; slot < flows_.size(); slot++)
+            startFlow(slot, kEpoch + uniform(0, rtt));
+
+        unsigned char frame[kMaxHeaderLength];
+        Unit u = Unit();
+        while (!events_.empty()) {
+            int64_t when = events_.top().first;
+            uint32_t slot = events_.top().second;
+            events_.pop();
+
+            Flow& flow = flows_[slot];
+            if (step(flow, when, &u)) {
+                uint32_t caplen = packUnit(u, frame);
+                pcap_.append(when, frame, caplen, caplen + u.dataLength);
+                packets_++;
+                bytes_ += u.dataLength;
+            }
+
+            if (flow.phase != kDone)
+                events_.emplace(nextTime(flow), slot);
+            else if (started_ < options_.flows)
+                startFlow(slot, when + uniform(0, rtt));
+        }
+
+        fprintf(stderr, "%lu flows, %lu packets, %lu payload bytes, "
+                        "%.1f seconds of trace\n",
+                started_, packets_, bytes_,
+                static_cast<double>(lastTime_ - kEpoch) / 1e9);
+    }
+
+private:
+    int64_t uniform(int64_t low, int64_t high)
+    {
+        if (high <= low)
+            return low;
+        return std::uniform_int_distribution<int64_t>(low, high - 1)(gen_);
+    }
+
+    void startFlow(uint32_t slot, int64_t when)
+    {
+        Flow& flow = flows_[slot];
+        flow = Flow();
+        flow.id = static_cast<uint32_t>(started_++);
+        flow.phase = kHandshake;
+        flow.wsc = wsc_;
+        flow.start = when;
+        // rtprop uniform in [rtt/2, 3rtt/2)
+        auto rtt = static_cast<int64_t>(options_.rttMs * 1e6);
+        flow.rtprop = std::max<int64_t>(uniform(rtt / 2, rtt * 3 / 2), 1000);
+        flow.spacing = std::max<int64_t>(static_cast<int64_t>(
+                kMss * 8 * 1000 / options_.bottleneckMbps), 1);
+        flow.total = options_.flowBytes;
+        flow.isn = static_cast<uint32_t>(gen_());
+        flow.cwnd = kInitialWindow;
+        flow.ssthresh = UINT32_MAX;
+        flow.nextRound = INT64_MAX;
+        events_.emplace(when, slot);
+    }
+
+    void fillHeader(const Flow& flow, bool fromSender, Unit* u) const
+    {
+        uint32_t receiverIP = htobe32(0x0b000000 + flow.id / kPortsPerAddress);
+        auto receiverPort = htobe16(static_cast<uint16_t>(
+                10000 + flow.id % kPortsPerAddress));
+        u->srcIP = fromSender ? senderIP_ : receiverIP;
+        u->dstIP = fromSender ? receiverIP : senderIP_;
+        u->srcPort = fromSender ? senderPort_ : receiverPort;
+        u->dstPort = fromSender ? receiverPort : senderPort_;
+        u->recvWindow = fromSender ? UINT16_MAX : options_.rwnd >> flow.wsc;
+        u->dataLength = 0;
+        u->flag = TH_ACK;
+        u->seeMss = false;
+        u->seeWsc = false;
+        u->sackCount = 0;
+    }
+
+    // ack |i| of the current round arrives at the same offset as data |i|
+    // leaves, an ack goes first when both are due
+    int64_t nextTime(const Flow& flow) const
+    {
+        if (flow.phase != kData)
+            return flow.start + (flow.step == 0 ? 0 : flow.rtprop);
+        int64_t when = flow.nextRound;
+        if (flow.ackIndex < flow.acks.segments)
+            when = std::min(when, flow.data.start +
+                                  flow.ackIndex * flow.spacing);
+        if (flow.dataIndex < flow.data.segments)
+            when = std::min(when, flow.data.start +
+                                  flow.dataIndex * flow.spacing);
+        return when;
+    }
+
+    // the unit of |flow| due at |when|, false if none is, the flow only
+    // moved on to its next round
+    bool step(Flow& flow, int64_t when, Unit* u)
+    {
+        lastTime_ = when;
+        switch (flow.phase) {
+            case kHandshake:
+                return handshake(flow, u);
+            case kClosing:
+                return closeFlow(flow, u);
+            default:
+                break;
+        }
+
+        if (flow.ackIndex < flow.acks.segments &&
+            flow.data.start + flow.ackIndex * flow.spacing == when) {
+            sendAck(flow, u);
+            return true;
+        }
+        if (flow.dataIndex < flow.data.segments &&
+            flow.data.start + flow.dataIndex * flow.spacing == when) {
+            sendData(flow, u);
+            return true;
+        }
+        beginRound(flow, when);
+        return false;
+    }
+
+    bool handshake(Flow& flow, Unit* u)
+    {
+        switch (flow.step++) {
+            case 0:
+                fillHeader(flow, true, u);
+                u->flag = TH_SYN;
+                u->dataSequence = flow.isn;
+                u->ackSequence = 0;
+                u->mss = kMss;
+                u->wsc = flow.wsc;
+                u->seeMss = u->seeWsc = true;
+                return true;
+            case 1:
+                fillHeader(flow, false, u);
+                u->flag = TH_SYN | TH_ACK;
+                u->dataSequence = 0;
+                u->ackSequence = flow.isn + 1;
+                u->recvWindow = std::min<uint32_t>(options_.rwnd, UINT16_MAX);
+                u->mss = kMss;
+                u->wsc = flow.wsc;
+                u->seeMss = u->seeWsc = true;
+                return true;
+            default:
+                // the sender acks the syn and starts the first round
+                fillHeader(flow, true, u);
+                u->dataSequence = flow.isn + 1;
+                u->ackSequence = 1;
+                flow.phase = kData;
+                flow.data.seq = flow.isn + 1;
+                beginRound(flow, flow.start + flow.rtprop);
+                return true;
+        }
+    }
+
+    bool closeFlow(Flow& flow, Unit* u)
+    {
+        uint32_t finSeq = flow.isn + 1 + static_cast<uint32_t>(flow.sent);
+        if (flow.step++ == 0) {
+            fillHeader(flow, true, u);
+            u->flag = TH_FIN | TH_ACK;
+            u->dataSequence = finSeq;
+            u->ackSequence = 1;
+        }
+        else {
+            fillHeader(flow, false, u);
+            u->flag = TH_FIN | TH_ACK;
+            u->dataSequence = 1;
+            u->ackSequence = finSeq + 1;
+            flow.phase = kDone;
+        }
+        return true;
+    }
+
+    void sendData(Flow& flow, Unit* u)
+    {
+        const Round& r = flow.data;
+        uint32_t i = flow.dataIndex++;
+        fillHeader(flow, true, u);
+        u->ackSequence = 1;
+        if (r.rexmit && i == 0) {
+            u->dataSequence = r.rexmitSeq;
+            u->dataLength = r.rexmitLength;
+        }
+        else {
+            u->dataSequence = r.segmentBegin(i);
+            u->dataLength = r.segmentEnd(i) - r.segmentBegin(i);
+        }
+        if (i + 1 == r.segments)
+            u->flag |= TH_PUSH;
+    }
+
+    // the acks of a round with a loss stop at the hole, the later ones are
+    // duplicates, selective with sack. the retransmission in the next
+    // round then acks the whole round at once
+    void sendAck(Flow& flow, Unit* u)
+    {
+        const Round& r = flow.acks;
+        uint32_t i = flow.ackIndex++;
+        if (flow.ackIndex == r.lost)
+            flow.ackIndex++;
+
+        fillHeader(flow, false, u);
+        u->dataSequence = 1;
+        if (r.rexmit && i == 0) {
+            u->ackSequence = r.seq;
+            return;
+        }
+        if (r.lost == kNoLoss || i < r.lost) {
+            u->ackSequence = r.segmentEnd(i);
+            return;
+        }
+        u->ackSequence = r.segmentBegin(r.lost);
+        if (options_.sack) {
+            u->sackCount = 1;
+            u->sackBlock[0].leftEdge = r.segmentEnd(r.lost);
+            u->sackBlock[0].rightEdge = r.segmentEnd(i);
+        }
+    }
+
+    // bytes the application has written and the sender not sent yet
+    uint64_t available(const Flow& flow, int64_t now) const
+    {
+        uint64_t left = flow.total - flow.sent;
+        if (options_.appKBps <= 0)
+            return left;
+        double written = options_.appKBps * 1000 *
+                         static_cast<double>(now - flow.start) / 1e9;
+        double ready = written - static_cast<double>(flow.sent);
+        if (ready <= 0)
+            return 0;
+        return std::min(left, static_cast<uint64_t>(ready));
+    }
+
+    // the acks of the round just sent start to arrive: react to them and
+    // send the next window
+    void beginRound(Flow& flow, int64_t now)
+    {
+        const Round prev = flow.data;
+        bool lost = prev.lost != kNoLoss;
+        if (lost) {
+            flow.ssthresh = std::max<uint32_t>(flow.cwnd / 2, 2);
+            flow.cwnd = flow.ssthresh;
+        }
+        else if (flow.cwndLimited) {
+            flow.cwnd = flow.cwnd < flow.ssthresh
+                        ? std::min(flow.cwnd * 2, flow.ssthresh)
+                        : flow.cwnd + 1;
+        }
+
+        flow.acks = prev;
+        flow.ackIndex = prev.lost == 0 ? 1 : 0;
+        int64_t acksEnd = now + prev.segments * flow.spacing;
+
+        Round& r = flow.data;
+        r = Round();
+        r.start = now;
+        r.seq = flow.isn + 1 + static_cast<uint32_t>(flow.sent);
+        if (lost) {
+            r.rexmit = true;
+            r.rexmitSeq = prev.segmentBegin(prev.lost);
+            r.rexmitLength = prev.segmentEnd(prev.lost) - r.rexmitSeq;
+        }
+        flow.dataIndex = 0;
+
+        uint64_t ready = available(flow, now);
+        if (!lost && ready == 0) {
+            if (flow.sent == flow.total) {
+                // the fin follows the last ack
+                if (prev.segments == 0) {
+                    flow.phase = kClosing;
+                    flow.start = now;
+                    flow.step = 0;
+                }
+                flow.nextRound = acksEnd;
+                return;
+            }
+            // the application is idle, wait for its next write
+            double wait = static_cast<double>(std::min<uint64_t>(
+                    kMss, flow.total - flow.sent)) * 1e6 / options_.appKBps;
+            flow.nextRound = std::max(acksEnd,
+                                      now + static_cast<int64_t>(wait));
+            flow.cwndLimited = false;
+            return;
+        }
+
+        // the window and what bounds it
+        uint64_t cwndBytes = static_cast<uint64_t>(flow.cwnd) * kMss;
+        uint64_t window = std::min<uint64_t>(
+                {cwndBytes, options_.rwnd, options_.sndbuf});
+        window = std::max<uint64_t>(window, kMss);
+        uint64_t room = window - (r.rexmit ? kMss : 0);
+
+        RoundtripLimit limit;
+        if (ready < room)
+            limit = kApplication;
+        else if (window == options_.rwnd && window < cwndBytes)
+            limit = kReceiveWindow;
+        else if (window == options_.sndbuf && window < cwndBytes)
+            limit = kSendBuffer;
+        else if (flow.cwnd < flow.ssthresh)
+            limit = kSlowStart;
+        else
+            limit = kCongestionControl;
+        flow.cwndLimited = limit == kSlowStart ||
+                           limit == kCongestionControl;
+
+        // a standing queue builds once the window exceeds the pipe. a
+        // window past the pipe and the buffer overflows the queue: it is
+        // cut there and its last segment dropped, else at most one random
+        // loss
+        auto pipe = static_cast<uint32_t>(flow.rtprop / flow.spacing) + 1;
+        uint32_t buffer = options_.queueBytes / kMss;
+        uint64_t fits = static_cast<uint64_t>(pipe + buffer + 1) * kMss;
+        bool overflow = room + (r.rexmit ? kMss : 0) > fits;
+        if (overflow)
+            room = fits - (r.rexmit ? kMss : 0);
+
+        r.bytes = static_cast<uint32_t>(std::min(room, ready));
+        r.segments = (r.bytes + kMss - 1) / kMss + r.rexmit;
+        flow.sent += r.bytes;
+
+        if (overflow && r.bytes == room) {
+            r.lost = r.segments - 1;
+        }
+        else if (options_.lossRate > 0) {
+            std::geometric_distribution<uint32_t> loss(options_.lossRate);
+            uint32_t i = (r.rexmit ? 1 : 0) + loss(gen_);
+            if (i < r.segments)
+                r.lost = i;
+        }
+
+        int64_t duration = std::max<int64_t>(flow.rtprop,
+                                             r.segments * flow.spacing);
+        flow.nextRound = std::max(now + duration, acksEnd);
+
+        if (duration > flow.rtprop * 5 / 2)
+            limit = kBufferbloat;
+        else if (flow.cwndLimited &&
+                 (r.lost != kNoLoss || duration > flow.rtprop * 7 / 5))
+            limit = kCongestion;
+        else if (limit == kCongestionControl && r.segments >= pipe)
+            limit = kBandwidth;
+
+        flow.roundtrip++;
+        writeLabel(flow, now, now + duration, limit, r.segments);
+    }
+
+    void writeLabel(const Flow& flow, int64_t start, int64_t end,
+                    RoundtripLimit limit, uint32_t segments)
+    {
+        if (labels_ == nullptr)
+            return;
+        uint32_t address = 0x0b000000 + flow.id / kPortsPerAddress;
+        fprintf(labels_, "%u.%u.%u.%u:%u %u %ld %ld %s %u\n",
+                address >> 24, (address >> 16) & 0xff,
+                (address >> 8) & 0xff, address & 0xff,
+                10000 + flow.id % kPortsPerAddress, flow.roundtrip,
+                start / 1000, end / 1000, roundtripLimitName(limit),
+                segments);
+    }
+
+    typedef std::pair<int64_t, uint32_t> Event;
+
+    const Options options_;
+    PcapWriter pcap_;
+    FILE* labels_;
+    std::mt19937_64 gen_;
+    std::vector<Flow> flows_;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+    uint32_t senderIP_;
+    uint16_t senderPort_;
+    uint8_t wsc_;
+    uint64_t started_;
+    uint64_t packets_;
+    uint64_t bytes_;
+    int64_t lastTime_;
+};
+
+void usage()
+{
+    fprintf(stderr,
+            "./trace_synthesizer [options] out.pcap\n"
+            "  -n flows         flows in total (1000)\n"
+            "  -c flows         flows at a time (100)\n"
+            "  -b bytes         bytes per flow (1048576)\n"
+            "  -r ms            mean rtprop, per flow in [r/2, 3r/2) (50)\n"
+            "  -B Mbit/s        bottleneck of each path (100)\n"
+            "  -q bytes         bottleneck buffer (262144)\n"
+            "  -w bytes         receive window (4194304)\n"
+            "  -s bytes         send buffer (4194304)\n"
+            "  -a KB/s          application write rate, 0 for bulk (0)\n"
+            "  -l probability   random loss per segment (0.0001)\n"
+            "  -k               no sack\n"
+            "  -S seed          random seed (1)\n"
+            "  -L file          ground truth, a line per round trip\n"
+            "scenarios:\n"
+            "  bulk             -b 104857600\n"
+            "  ssh-like         -a 20 -b 1048576\n"
+            "  receiver limited -w 65535 -b 104857600\n"
+            "  buffer limited   -s 131072 -b 104857600\n"
+            "  bufferbloat      -q 16777216 -l 0 -b 104857600\n"
+            "  scale            -n 10000000 -c 1000000 -b 65536\n");
+    exit(1);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:b:r:B:q:w:s:a:l:kS:L:")) != -1) {
+        switch (opt) {
+            case 'n':
+                options.flows = strtoull(optarg, nullptr, 10);
+                break;
+            case 'c':
+                options.concurrent = static_cast<uint32_t>(
+                        strtoul(optarg, nullptr, 10));
+                break;
+            case 'b':
+                options.flowBytes = strtoull(optarg, nullptr, 10);
+                break;
+            case 'r':
+                options.rttMs = atof(optarg);
+                break;
+            case 'B':
+                options.bottleneckMbps = atof(optarg);
+                break;
+            case 'q':
+                options.queueBytes = static_cast<uint32_t>(
+                        strtoul(optarg, nullptr, 10));
+                break;
+            case 'w':
+                options.rwnd = static_cast<uint32_t>(
+                        strtoul(optarg, nullptr, 10));
+                break;
+            case 's':
+                options.sndbuf = static_cast<uint32_t>(
+                        strtoul(optarg, nullptr, 10));
+                break;
+            case 'a':
+                options.appKBps = atof(optarg);
+                break;
+            case 'l':
+                options.lossRate = atof(optarg);
+                break;
+            case 'k':
+                options.sack = false;
+                break;
+            case 'S':
+                options.seed = strtoull(optarg, nullptr, 10);
+                break;
+            case 'L':
+                options.labelPath = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + 1 != argc || options.flows == 0 || options.concurrent == 0 ||
+        options.flowBytes == 0 || options.rttMs <= 0 ||
+        options.bottleneckMbps <= 0 || options.lossRate >= 1 ||
+        options.rwnd < kMss || options.sndbuf < kMss) {
+        usage();
+    }
+
+    Synthesizer synthesizer(options, argv[optind]);
+    synthesizer.run();
+}